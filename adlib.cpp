@@ -5,28 +5,339 @@
 /********************************************************/
 #include "adlib.h"
 
-#include "pros/motors.hpp"
 #include "pros/imu.hpp"
-#include "pros/optical.hpp"
 #include "pros/rotation.hpp"
 
+#include <cmath>
+
+/********************************************************/
+/* Timeline tracing                                     */
+/********************************************************/
+namespace adlib {
+	Trace::Buffer Trace::buffers[MAX_TASKS];
+	const char* Trace::names[MAX_NAMES];
+	std::atomic<int> Trace::num_of_names{0};
+	AtomicFlag Trace::enabled;
+	std::atomic<uint32_t> Trace::dropped{0};
+
+	// Register an event name and get its id, s must stay valid (a string literal)
+	uint16_t Trace::name(const char* s) {
+		int id = num_of_names.fetch_add(1);
+		if(id >= UNKNOWN_NAME) {
+			num_of_names.store(UNKNOWN_NAME);
+			return UNKNOWN_NAME;	// table is full, dumped as "?"
+		}
+		names[id] = s;
+		return id;
+	}
+
+	void Trace::begin(uint16_t id) {
+		add(EV_BEGIN, id);
+	}
+
+	void Trace::end(uint16_t id) {
+		add(EV_END, id);
+	}
+
+	void Trace::instant(uint16_t id) {
+		add(EV_INSTANT, id);
+	}
+
+	// Tracing is off until enabled, a disabled event costs one atomic load
+	void Trace::enable(bool on) {
+		if(on)
+			enabled.set();
+		else
+			enabled.clear();
+	}
+
+	void Trace::add(uint8_t type, uint16_t id) {
+		if(!enabled.test())
+			return;
+		Buffer* b = buffer();
+		if(b == nullptr) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		uint32_t n = b->head.load(std::memory_order_relaxed);
+		Event& e = b->events[n & (EVENTS_PER_TASK - 1)];
+		e.time_us = pros::micros();
+		e.name = id;
+		e.type = type;
+		b->head.store(n + 1, std::memory_order_release);
+	}
+
+	// Buffer of the calling task, claimed on its first event. PROS deletes and recreates the
+	// competition tasks on every mode change, so a new task takes over the buffer of an
+	// earlier task with the same name instead of claiming another one. Tasks that run at
+	// the same time need different names for this, unnamed tasks always get their own.
+	Trace::Buffer* Trace::buffer() {
+		pros::task_t self = pros::c::task_get_current();
+		for(int i=0; i<MAX_TASKS; i++) {
+			if(buffers[i].owner.load(std::memory_order_acquire) == self)
+				return &buffers[i];
+		}
+		const char* name = pros::c::task_get_name(self);
+		if(name == nullptr)
+			name = "";
+		if(name[0] != '\0') {
+			for(int i=0; i<MAX_TASKS; i++) {
+				if(buffers[i].owner.load(std::memory_order_acquire) != nullptr &&
+				   strncmp(buffers[i].task_name, name, sizeof(buffers[i].task_name) - 1) == 0) {
+					buffers[i].owner.store(self, std::memory_order_release);
+					return &buffers[i];
+				}
+			}
+		}
+		for(int i=0; i<MAX_TASKS; i++) {
+			pros::task_t expected = nullptr;
+			if(buffers[i].owner.compare_exchange_strong(expected, self)) {
+				snprintf(buffers[i].task_name, sizeof(buffers[i].task_name), "%s", name);
+				return &buffers[i];
+			}
+		}
+		return nullptr;	// more tasks than buffers, the event is dropped
+	}
+
+	// Write the buffered events as Chrome trace JSON (chrome://tracing, Perfetto).
+	// Tracing is paused while writing.
+	bool Trace::dump(const char* filename) {
+		if (!pros::usd::is_installed())
+			return false;
+		FILE* file = fopen(filename, "w");
+		if (file == nullptr)
+			return false;
+
+		bool was_enabled = enabled.test();
+		enabled.clear();
+		int count = std::min(num_of_names.load(), (int)UNKNOWN_NAME);
+
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+		for(int t=0; t<MAX_TASKS; t++) {
+			Buffer& b = buffers[t];
+			if(b.owner.load() == nullptr)
+				continue;
+
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+					first ? "" : ",\n", t, b.task_name[0] != '\0' ? b.task_name : "task");
+			first = false;
+
+			uint32_t n = b.head.load(std::memory_order_acquire);
+			uint32_t start = (n > EVENTS_PER_TASK) ? n - EVENTS_PER_TASK : 0;
+			for(uint32_t i = start; i < n; i++) {
+				Event& e = b.events[i & (EVENTS_PER_TASK - 1)];
+				const char* name = (e.name < count) ? names[e.name] : "?";
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":0,\"tid\":%d%s}",
+						name, e.type, (unsigned)e.time_us, t, e.type == EV_INSTANT ? ",\"s\":\"t\"" : "");
+				if((i - start) % 256 == 255)
+					pros::delay(1);	// Need break between writes to the SD card
+			}
+		}
+		fprintf(file, "\n],\"otherData\":{\"dropped_events\":%u}}\n", (unsigned)dropped.load());
+		fclose(file);
+
+		if(was_enabled)
+			enabled.set();
+		return true;
+	}
+}
+
+/********************************************************/
+/* Device I/O accounting                                */
+/********************************************************/
+namespace adlib {
+	IoStats::Counter IoStats::counters[MAX_PORTS][(int)IoCall::Count];
+	IoStats::TaskCounter IoStats::tasks[MAX_TASKS];
+	IoStats::TaskCounter IoStats::other_tasks;
+	std::atomic<uint32_t> IoStats::start_ms{0};
+	AtomicFlag IoStats::enabled;
+
+	// Accounting is off until enabled, a disabled access costs one atomic load
+	void IoStats::enable(bool on) {
+		if(on) {
+			start_ms.store(pros::millis());
+			enabled.set();
+		}
+		else {
+			enabled.clear();
+		}
+	}
+
+	void IoStats::reset() {
+		for(int p=0; p<MAX_PORTS; p++) {
+			for(int c=0; c<(int)IoCall::Count; c++) {
+				counters[p][c].calls.store(0);
+				counters[p][c].time_us.store(0);
+				counters[p][c].duplicates.store(0);
+				counters[p][c].seen.store(0);
+			}
+		}
+		for(int i=0; i<MAX_TASKS; i++) {
+			tasks[i].calls.store(0);
+			tasks[i].time_us.store(0);
+		}
+		other_tasks.calls.store(0);
+		other_tasks.time_us.store(0);
+		start_ms.store(pros::millis());
+	}
+
+	// How often the device has new data for this kind of access
+	uint32_t IoStats::period_ms(IoCall type) {
+		switch (type) {
+			case IoCall::DistanceGet:
+				return Distance::UPDATE_MS;
+			case IoCall::MotorTelemetry:
+				return Motor::UPDATE_MS;
+			case IoCall::AdiRead:
+				return 10;
+			case IoCall::GetDigital:
+			case IoCall::GetAnalog:
+				return 10;
+			default:
+				return 0;	// never counted as duplicates
+		}
+	}
+
+	void IoStats::record(int port, IoCall type, int channel, uint32_t us) {
+		if(port < 0 || port >= MAX_PORTS)
+			port = 0;
+		Counter& c = counters[port][(int)type];
+		c.calls.fetch_add(1, std::memory_order_relaxed);
+		c.time_us.fetch_add(us, std::memory_order_relaxed);
+		uint32_t now = pros::millis();
+		int ch = (unsigned)channel % MAX_CHANNELS;
+		uint32_t last = c.last_ms[ch].exchange(now, std::memory_order_relaxed);
+		bool seen = c.seen.fetch_or(1u << ch, std::memory_order_relaxed) & (1u << ch);
+		uint32_t period = period_ms(type);
+		if(period > 0 && seen && now - last < period)
+			c.duplicates.fetch_add(1, std::memory_order_relaxed);
+
+		// Attribute to the calling task
+		TaskCounter* t = task_counter();
+		t->calls.fetch_add(1, std::memory_order_relaxed);
+		t->time_us.fetch_add(us, std::memory_order_relaxed);
+	}
+
+	// Counter of the calling task. A task that was deleted and started again under the
+	// same name takes over its old slot; past MAX_TASKS names the calls go to other_tasks.
+	IoStats::TaskCounter* IoStats::task_counter() {
+		pros::task_t self = pros::c::task_get_current();
+		for(int i=0; i<MAX_TASKS; i++) {
+			if(tasks[i].task.load(std::memory_order_acquire) == self)
+				return &tasks[i];
+		}
+		const char* name = pros::c::task_get_name(self);
+		if(name == nullptr)
+			name = "";
+		if(name[0] != '\0') {
+			for(int i=0; i<MAX_TASKS; i++) {
+				if(tasks[i].task.load(std::memory_order_acquire) != nullptr &&
+				   strncmp(tasks[i].name, name, sizeof(tasks[i].name) - 1) == 0) {
+					tasks[i].task.store(self, std::memory_order_release);
+					return &tasks[i];
+				}
+			}
+		}
+		for(int i=0; i<MAX_TASKS; i++) {
+			pros::task_t expected = nullptr;
+			if(tasks[i].task.compare_exchange_strong(expected, self)) {
+				snprintf(tasks[i].name, sizeof(tasks[i].name), "%s", name);
+				return &tasks[i];
+			}
+		}
+		return &other_tasks;
+	}
+
+	// One line per device and call type, then one per task
+	std::string IoStats::report() {
+		static const char* call_names[] = {
+			"distance get", "is_installed", "get_digital", "get_analog",
+			"motor telemetry", "optical get", "adi read", "adi write"
+		};
+		double sec = (pros::millis() - start_ms.load()) / 1000.0;
+		if(sec <= 0)
+			sec = 1;
+
+		std::string r = "device call              /s    avg us  dup%\n";
+		char line[96];
+		for(int p=0; p<MAX_PORTS; p++) {
+			for(int c=0; c<(int)IoCall::Count; c++) {
+				uint32_t calls = counters[p][c].calls.load();
+				if(calls == 0)
+					continue;
+				char device[8];
+				if(p == CONTROLLER_PORT)
+					snprintf(device, sizeof(device), "ctrl");
+				else if(p > ADI_PORT)
+					snprintf(device, sizeof(device), "adi %c", 'A' + p - ADI_PORT - 1);
+				else
+					snprintf(device, sizeof(device), "%d", p);
+				snprintf(line, sizeof(line), "%-6s %-16s %7.1f %8.1f %5.1f\n", device, call_names[c],
+						 calls / sec, (double)counters[p][c].time_us.load() / calls,
+						 100.0 * counters[p][c].duplicates.load() / calls);
+				r += line;
+			}
+		}
+		for(int i=0; i<MAX_TASKS; i++) {
+			if(tasks[i].task.load() == nullptr)
+				continue;
+			uint32_t calls = tasks[i].calls.load();
+			snprintf(line, sizeof(line), "task %-16s %7.1f /s %8u us total\n", tasks[i].name,
+					 calls / sec, (unsigned)tasks[i].time_us.load());
+			r += line;
+		}
+		uint32_t other = other_tasks.calls.load();
+		if(other > 0) {
+			snprintf(line, sizeof(line), "task %-16s %7.1f /s %8u us total\n", "(other tasks)",
+					 other / sec, (unsigned)other_tasks.time_us.load());
+			r += line;
+		}
+		return r;
+	}
+
+	bool IoStats::dump(const char* filename) {
+		if (!pros::usd::is_installed())
+			return false;
+		FILE* file = fopen(filename, "w");
+		if (file == nullptr)
+			return false;
+		std::string r = report();
+		fwrite(r.c_str(), 1, r.length(), file);
+		fclose(file);
+		return true;
+	}
+}
+
 /********************************************************/
 /* Controller                                           */
 /********************************************************/
 namespace adlib {
 	Controller::Controller(pros::controller_id_e_t id)
 		: pros::Controller(id) {
+		axes[0].id = ANALOG_LEFT_X;
+		axes[1].id = ANALOG_LEFT_Y;
+		axes[2].id = ANALOG_RIGHT_X;
+		axes[3].id = ANALOG_RIGHT_Y;
 	}
 
 	// Start the controller task
 	void Controller::start_task() {
 		if (controller_task == nullptr) {
 			controller_task = new pros::Task([this]() {
+				static const uint16_t TRACE_BUTTON = Trace::name("button_process");
+				static const uint16_t TRACE_PRINT = Trace::name("print_process");
 				int disp_cnt = 0;
 				while (true) {
+					Trace::begin(TRACE_BUTTON);
 					button_process();
-					if(disp_cnt == 0)
+					axis_process();
+					Trace::end(TRACE_BUTTON);
+					if(disp_cnt == 0) {
+						Trace::begin(TRACE_PRINT);
 						print_process();
+						Trace::end(TRACE_PRINT);
+					}
 
 					disp_cnt = (disp_cnt + 1) % 2;  //disp_cnt becomes 0 every 50 msec
 					pros::delay(25);
@@ -37,7 +348,9 @@ namespace adlib {
 
 	// Check if a button is currently pressed
 	bool Controller::is_button_pressed(int button) {
-		return get_digital(static_cast<pros::controller_digital_e_t>(button));
+		return IoStats::call(IoStats::CONTROLLER_PORT, IoCall::GetDigital, [&]() {
+			return get_digital(static_cast<pros::controller_digital_e_t>(button));
+		}, button);
 	}
 
 	// Register a callback for when a button is pressed
@@ -60,96 +373,387 @@ namespace adlib {
 		}
 	}
 
+	// Register a callback for when two buttons are held together
+	void Controller::chord_pressed(int button1, int button2, std::function<void()> callback) {
+		ChordStruct c;
+		c.button1 = button1;
+		c.button2 = button2;
+		c.on_press = callback;
+		chords.push_back(c);
+	}
+
+	// Button state seen by the last button_process()
+	bool Controller::button_state(int button) {
+		for (int i = 0; i < num_of_buttons; i++) {
+			if (buttons[i].id == button) {
+				return buttons[i].last_state;
+			}
+		}
+		return false;
+	}
+
 	// Process button states and trigger callbacks
 	void Controller::button_process() {
+		BlackBox* box = BlackBox::instance;
 		for (int i = 0; i < num_of_buttons; i++) {
 			bool state = is_button_pressed(buttons[i].id);
 
 			if (state && !buttons[i].last_state) { // Button was just pressed
+				if (box != nullptr) {
+					box->record(RecordType::Button, buttons[i].id, 1);
+				}
 				if (buttons[i].on_press != nullptr) {
 					buttons[i].on_press();
 				}
 				buttons[i].last_state = state;
 			}
 			else if (!state && buttons[i].last_state) { // Button was just released
+				if (box != nullptr) {
+					box->record(RecordType::Button, buttons[i].id, 0);
+				}
 				if (buttons[i].on_release != nullptr) {
 					buttons[i].on_release();
 				}
 				buttons[i].last_state = state;
 			}
 		}
+
+		for (int i = 0; i < chords.size(); i++) {
+			bool state = button_state(chords[i].button1) && button_state(chords[i].button2);
+			if (state && !chords[i].last_state && chords[i].on_press != nullptr) {
+				chords[i].on_press();
+			}
+			chords[i].last_state = state;
+		}
 	}
 
-	bool Controller::is_buf_full() {
-		return (wr_ptr + 1) % MAX_NUM_OF_MSG == rd_ptr;
+	Controller::AxisStruct* Controller::find_axis(int axis) {
+		for (int i = 0; i < 4; i++) {
+			if (axes[i].id == axis) {
+				return &axes[i];
+			}
+		}
+		return nullptr;
 	}
 
-	bool Controller::is_buf_empty() {
-		return rd_ptr == wr_ptr;
+	// Axis value sampled by the controller task, no device access
+	int Controller::get_axis(int axis) {
+		AxisStruct* a = find_axis(axis);
+		return (a != nullptr) ? a->value.load() : 0;
 	}
 
-	void Controller::update_wr_ptr() {
-		wr_ptr = (wr_ptr + 1) % MAX_NUM_OF_MSG;
+	// Register a callback for when an axis moves by threshold or more. The value is also
+	// published every keepalive_ms while the stick is still, 0 turns that off.
+	void Controller::axis_changed(int axis, std::function<void(int)> callback, int threshold, int keepalive_ms) {
+		AxisStruct* a = find_axis(axis);
+		if (a == nullptr)
+			return;
+		a->threshold = threshold;
+		a->keepalive_ms = keepalive_ms;
+		a->on_change = callback;
 	}
 
-	void Controller::update_rd_ptr() {
-		rd_ptr = (rd_ptr + 1) % MAX_NUM_OF_MSG;
+	// Sample the axes and publish the ones that moved
+	void Controller::axis_process() {
+		uint32_t now = pros::millis();
+		BlackBox* box = BlackBox::instance;
+		for (int i = 0; i < 4; i++) {
+			AxisStruct& a = axes[i];
+			int value = IoStats::call(IoStats::CONTROLLER_PORT, IoCall::GetAnalog, [&]() {
+				return get_analog(static_cast<pros::controller_analog_e_t>(a.id));
+			}, a.id);
+			a.value.store(value);
+			if (a.on_change == nullptr)
+				continue;
+
+			bool moved = abs(value - a.published) >= a.threshold ||
+						 (value == 0 && a.published != 0);	// always publish the return to center
+			bool keepalive = a.keepalive_ms > 0 && now - a.published_time >= (uint32_t)a.keepalive_ms;
+			if (moved || keepalive) {
+				a.published = value;
+				a.published_time = now;
+				if (moved && box != nullptr) {
+					box->record(RecordType::Axis, a.id, value);
+				}
+				a.on_change(value);
+			}
+		}
 	}
 
 	void Controller::clear(int row) {
-		if(is_buf_full())
-			return;
-
 		if(row == -1) {	//clear all
-			buf[wr_ptr][0] = MSG_CLEAR;
-			update_wr_ptr();
+			if (msgs.emplace([](Message& m) {
+				m.data[0] = MSG_CLEAR;
+			}))
+				msg_seq++;
 		}
 		else {	//clear a single row
 			print(row, 0, "%28s", "");
 		}
 	}
 
+	// The message is dropped if the queue is full
 	void Controller::print(int row, int col, const char* fmt, ...) {
-		if(is_buf_full())
-			return;
-
-		buf[wr_ptr][0] = MSG_TEXT;
-		buf[wr_ptr][1] = char(row);
-		buf[wr_ptr][2] = char(col);
 		va_list args;
 		va_start(args, fmt);
-		vsnprintf(&(buf[wr_ptr][3]), MAX_MSG_LEN-4, fmt, args);
+		if (msgs.emplace([&](Message& m) {
+			m.data[0] = MSG_TEXT;
+			m.data[1] = char(row);
+			m.data[2] = char(col);
+			vsnprintf(&(m.data[3]), MAX_MSG_LEN-4, fmt, args);
+		}))
+			msg_seq++;
 		va_end(args);
-		update_wr_ptr();
 	}
 
 	void Controller::rumble(const char* rumble_pattern) {
-		if(is_buf_full())
-			return;
-
-		buf[wr_ptr][0] = MSG_RUMBLE;
-		snprintf(&(buf[wr_ptr][1]), MAX_MSG_LEN-1, "%s", rumble_pattern);
-		update_wr_ptr();
+		if (msgs.emplace([&](Message& m) {
+			m.data[0] = MSG_RUMBLE;
+			snprintf(&(m.data[1]), MAX_MSG_LEN-1, "%s", rumble_pattern);
+		}))
+			msg_seq++;
 	}
 
 	void Controller::print_process() {
-		if(is_buf_empty())
+		Message m;
+		if(!msgs.pop(m))
 			return;
 
-		if (buf[rd_ptr][0] == MSG_CLEAR) {
+		if (m.data[0] == MSG_CLEAR) {
 			pros::Controller::clear();
 		}
-		else if (buf[rd_ptr][0] == MSG_RUMBLE) {
-			char* pattern = &(buf[rd_ptr][1]);
+		else if (m.data[0] == MSG_RUMBLE) {
+			char* pattern = &(m.data[1]);
 			pros::Controller::rumble(pattern);
 		}
-		else if (buf[rd_ptr][0] == MSG_TEXT) {
-			int row = (int)buf[rd_ptr][1];
-			int col = (int)buf[rd_ptr][2];
-			char* msg = &(buf[rd_ptr][3]);
-			pros::Controller::print(row, col, msg);
+		else if (m.data[0] == MSG_TEXT) {
+			int row = (int)m.data[1];
+			int col = (int)m.data[2];
+			char* msg = &(m.data[3]);
+			pros::Controller::print(row, col, "%s", msg);
+		}
+		else if (m.data[0] == MSG_DEFERRED) {
+			deferred_mutex.take(TIMEOUT_MAX);
+			Deferred d = deferred[(int)m.data[1]];
+			deferred[(int)m.data[1]].queued = false;
+			deferred_mutex.give();
+
+			char msg[MAX_MSG_LEN];
+			format_deferred(d, msg, MAX_MSG_LEN-4);
+			pros::Controller::print(d.row, d.col, "%s", msg);
+		}
+	}
+
+	// Keep the values in a slot, the queue only holds the slot number. A queued slot for the
+	// same position just gets the newer values, but only while it is the last message in the
+	// queue; after a clear() or print() behind it the new values need a message of their own.
+	void Controller::queue_deferred(const Deferred& d) {
+		deferred_mutex.take(TIMEOUT_MAX);
+		int slot = -1;
+		for (int i = 0; i < MAX_NUM_OF_MSG; i++) {
+			Deferred& s = deferred[i];
+			if (s.queued && s.row == d.row && s.col == d.col && s.seq == msg_seq.load()) {
+				s.fmt = d.fmt;
+				s.num_args = d.num_args;
+				for (int a = 0; a < d.num_args; a++)
+					s.args[a] = d.args[a];
+				deferred_mutex.give();
+				return;
+			}
+			if (!s.queued && (slot < 0 || (s.row == d.row && s.col == d.col)))
+				slot = i;	// a free slot, preferably the one last used for the position
+		}
+		if (slot < 0) {
+			deferred_mutex.give();
+			return;		// every slot is waiting to be sent, the print is dropped
+		}
+
+		deferred[slot] = d;
+		Message m;
+		m.data[0] = MSG_DEFERRED;
+		m.data[1] = char(slot);
+		deferred[slot].queued = msgs.push(m);
+		if (deferred[slot].queued)
+			deferred[slot].seq = ++msg_seq;
+		deferred_mutex.give();
+	}
+
+	// printf for the queued values, one conversion at a time
+	void Controller::format_deferred(const Deferred& m, char* out, int len) {
+		const char* f = m.fmt;
+		int n = 0;		// characters written
+		int arg = 0;
+		while (*f != '\0' && n < len - 1) {
+			if (*f != '%') {
+				out[n++] = *f++;
+				continue;
+			}
+			if (f[1] == '%') {
+				out[n++] = '%';
+				f += 2;
+				continue;
+			}
+
+			// Copy the conversion without length modifiers, the values are stored as int32 or double.
+			// A * width or precision takes the next value and is written into spec as a number.
+			char spec[24];
+			int k = 0;
+			spec[k++] = *f++;
+			while (*f != '\0' && strchr("diouxXcsfFeEgGaAp", *f) == nullptr) {
+				if (*f == '*') {
+					int v = 0;
+					if (arg < m.num_args) {
+						const Arg& a = m.args[arg++];
+						v = (a.type == Arg::DOUBLE) ? (int)a.d : (a.type == Arg::INT) ? a.i : 0;
+					}
+					if (spec[k - 1] == '.' && v < 0) {
+						k--;	// negative precision is taken as if omitted
+					}
+					else {
+						int r = snprintf(&spec[k], sizeof(spec) - 2 - k, "%d", std::max(-99, std::min(99, v)));
+						k = std::min(k + std::max(r, 0), (int)sizeof(spec) - 2);
+					}
+				}
+				else if (strchr("hlLzjt", *f) == nullptr && k < (int)sizeof(spec) - 2)
+					spec[k++] = *f;
+				f++;
+			}
+			if (*f == '\0')
+				break;
+			char conv = *f++;
+			spec[k++] = conv;
+			spec[k] = '\0';
+			if (arg >= m.num_args)
+				break;
+
+			const Arg& a = m.args[arg++];
+			int r;
+			if (strchr("fFeEgGaA", conv) != nullptr)
+				r = snprintf(&out[n], len - n, spec, a.type == Arg::DOUBLE ? a.d : (double)a.i);
+			else if (conv == 's' || conv == 'p')
+				r = snprintf(&out[n], len - n, spec, a.type == Arg::STRING ? a.s : "");
+			else
+				r = snprintf(&out[n], len - n, spec, a.type == Arg::DOUBLE ? (int32_t)a.d : a.i);
+			if (r < 0)
+				break;
+			n = std::min(n + r, len - 1);
+		}
+		out[n] = '\0';
+	}
+}
+
+/********************************************************/
+/* Match clock                                          */
+/********************************************************/
+namespace adlib {
+	MatchClock::MatchClock(Controller& controller, int auton_sec, int driver_sec)
+		: controller(controller) {
+		auton_ms = auton_sec * 1000;
+		driver_ms = driver_sec * 1000;
+	}
+
+	// Call back when sec_remaining seconds are left in the given period
+	void MatchClock::at(MatchPhase phase, int sec_remaining, std::function<void()> callback) {
+		events.push_back({ phase, sec_remaining * 1000, callback });
+	}
+
+	// Rumble the controller when sec_remaining seconds are left in driver control
+	void MatchClock::rumble_at(int sec_remaining, const char* rumble_pattern) {
+		std::string pattern = rumble_pattern;
+		at(MatchPhase::Driver, sec_remaining, [this, pattern]() {
+			controller.rumble(pattern.c_str());
+		});
+	}
+
+	// Show the remaining time on the controller every second from from_sec down to 0
+	void MatchClock::countdown(int from_sec, int row, int col) {
+		for(int sec = from_sec; sec >= 0; sec--) {
+			at(MatchPhase::Driver, sec, [this, sec, row, col]() {
+				controller.print(row, col, "%d:%02d ", sec / 60, sec % 60);
+			});
+		}
+	}
+
+	// Start the clock task, it follows the competition mode and runs due events
+	void MatchClock::start_task() {
+		if (clock_task == nullptr) {
+			clock_task = new pros::Task([this]() {
+				while (true) {
+					MatchPhase p = MatchPhase::Driver;
+					if(pros::competition::is_disabled())
+						p = MatchPhase::Disabled;
+					else if(pros::competition::is_autonomous())
+						p = MatchPhase::Autonomous;
+
+					uint32_t now = pros::millis();
+					if(p != phase())
+						start_phase(p, now);
+
+					// Run every event that is due
+					uint32_t start = phase_start.load();
+					int length = phase_length_ms(p);
+					while(next < queue.size()) {
+						Event& e = events[queue[next]];
+						uint32_t due = start + length - e.remaining_ms;
+						if((int32_t)(now - due) < 0)
+							break;
+						next++;
+						if(e.callback != nullptr) {
+							e.callback();
+						}
+					}
+
+					// Sleep until the next event, but keep watching the mode
+					uint32_t wait = POLL_MS;
+					if(next < queue.size()) {
+						uint32_t due = start + length - events[queue[next]].remaining_ms;
+						now = pros::millis();
+						if((int32_t)(due - now) < POLL_MS)
+							wait = (int32_t)(due - now) > 0 ? due - now : 0;
+					}
+					pros::delay(wait);
+				}
+			});
+		}
+	}
+
+	void MatchClock::start_phase(MatchPhase p, uint32_t now) {
+		current_phase.store((int)p);
+		phase_start.store(now);
+		queue.clear();
+		next = 0;
+		if(p == MatchPhase::Disabled)
+			return;
+
+		int length = phase_length_ms(p);
+		for(int i=0; i<events.size(); i++) {
+			if(events[i].phase == p && events[i].remaining_ms <= length)
+				queue.push_back(i);
 		}
-		update_rd_ptr();
+		std::sort(queue.begin(), queue.end(), [this](int a, int b) {
+			return events[a].remaining_ms > events[b].remaining_ms;
+		});
+	}
+
+	int MatchClock::phase_length_ms(MatchPhase p) {
+		if(p == MatchPhase::Autonomous)
+			return auton_ms;
+		if(p == MatchPhase::Driver)
+			return driver_ms;
+		return 0;
+	}
+
+	MatchPhase MatchClock::phase() {
+		return (MatchPhase)current_phase.load();
+	}
+
+	// Milliseconds left in the current period, 0 when disabled
+	int MatchClock::remaining_ms() {
+		MatchPhase p = phase();
+		if(p == MatchPhase::Disabled)
+			return 0;
+		int left = phase_length_ms(p) - (int)(pros::millis() - phase_start.load());
+		return left > 0 ? left : 0;
 	}
 }
 
@@ -165,6 +769,12 @@ namespace adlib {
 
 	// Check if a device is connected
 	bool Brain::check_device(int port, Device type) {
+		return IoStats::call(port, IoCall::IsInstalled, [&]() {
+			return check_device_installed(port, type);
+		});
+	}
+
+	bool Brain::check_device_installed(int port, Device type) {
 		switch (type) {
 			case Device::Motor:
 				return pros::Motor(port).is_installed();
@@ -224,6 +834,8 @@ namespace adlib {
 
 		for(int i=0; i<buttons.size(); i++) {
 			if(buttons[i]->is_touched()) {
+				buttons[i]->show_pressed(true);
+				pressed_button = buttons[i];
 				if(buttons[i]->on_press != nullptr) {
 					buttons[i]->on_press();
 				}
@@ -234,6 +846,11 @@ namespace adlib {
 
 	// touch released callback, excute the whole screen or button callbacks
 	void Brain::touch_released_func() {
+		if(pressed_button != nullptr) {
+			pressed_button->show_pressed(false);
+			pressed_button = nullptr;
+		}
+
 		if(on_release != nullptr) {
 			if(!on_release()) {	// If the callback returns false, do not check buttons
 				return;
@@ -285,28 +902,122 @@ namespace adlib {
 
 	// Draw an image from a file to the brain screen at a specific position
 	void Brain::draw_image(const char* filename, int x, int y, int32_t bgcolor) {
+		static const uint16_t TRACE_ID = Trace::name("draw_image");
+		TraceScope trace(TRACE_ID);
+
+		image_mutex.take(TIMEOUT_MAX);
+		auto it = images.find(filename);
+		if (it != images.end()) {	// already decoded by cache_image()
+			draw_image(it->second, x, y, bgcolor);
+			image_mutex.give();
+			return;
+		}
+		image_mutex.give();
+
+		Image image;
+		if (!load_image(filename, image))
+			return;
+		draw_image(image, x, y, bgcolor);
+		pros::delay(5);
+	}
+
+	// Read an image file into RAM
+	bool Brain::load_image(const char* filename, Image& image) {
+		if (assets != nullptr && assets->load(filename, image.storage)) {
+			image.external = nullptr;
+			image.external_size = 0;
+			if (!parse_image(image)) {
+				print(11, 0, 0xff0000, "Invalid image file!");
+				return false;
+			}
+			return true;
+		}
+
 		if (!pros::usd::is_installed()) {
 			print(11, 0, 0xff0000, "SD Card not found!");
-			return;
+			return false;
 		}
 
 		FILE* file = fopen(filename, "rb");
 		if (file == nullptr) {
 			print(11, 0, 0xff0000, "File not found!");
-			return;
+			return false;
 		}
 
-		int BUF_SIZE = 2048;
-		std::vector<uint8_t> buf(BUF_SIZE);
-		// Read the image size
-		size_t r = fread(buf.data(), 1, BUF_SIZE, file);
-		if(r < 4 + 1024) {	//size + palette
-			fclose(file);
+		const int BUF_SIZE = 2048;
+		image.external = nullptr;
+		image.external_size = 0;
+		image.storage.clear();
+		size_t r;
+		do {
+			size_t size = image.storage.size();
+			image.storage.resize(size + BUF_SIZE);
+			r = fread(image.storage.data() + size, 1, BUF_SIZE, file);
+			image.storage.resize(size + r);
+			pros::delay(1); // Need break between fread from the SD card
+		} while (r == BUF_SIZE);
+		fclose(file);
+
+		if (!parse_image(image)) {
 			print(11, 0, 0xff0000, "Invalid image file!");
+			return false;
+		}
+		return true;
+	}
+
+	// Use an image linked into the program, the data is not copied and must stay valid.
+	// Turn an image file into a C array on the host with: xxd -i splash.bin > splash.h
+	// and declare the array const.
+	bool Brain::load_image(const uint8_t* data, size_t size, Image& image) {
+		image.storage.clear();
+		image.external = data;
+		image.external_size = size;
+		if (data == nullptr || !parse_image(image)) {
+			print(11, 0, 0xff0000, "Invalid image data!");
+			return false;
+		}
+		return true;
+	}
+
+	// Draw an image linked into the program, no SD card needed
+	void Brain::draw_image(const uint8_t* data, size_t size, int x, int y, int32_t bgcolor) {
+		Image image;
+		if (!load_image(data, size, image))
 			return;
+		draw_image(image, x, y, bgcolor);
+	}
+
+	// Decode the size and the palette, check that all the pixels are there
+	bool Brain::parse_image(Image& image) {
+		const uint8_t* buf = image.external != nullptr ? image.external : image.storage.data();
+		size_t size = image.external != nullptr ? image.external_size : image.storage.size();
+		if (size < Image::HEADER_SIZE)
+			return false;
+
+		image.w = buf[0] << 8 | buf[1];
+		image.h = buf[2] << 8 | buf[3];
+		if (size < Image::HEADER_SIZE + (size_t)image.w * image.h)
+			return false;
+
+		image.transparent = false;
+		for (int i = 0; i < 256; i++) {
+			image.palette[i] = (buf[4+i*4] << 16) | (buf[4+i*4+1] << 8) | buf[4+i*4+2];
+			image.alpha[i] = buf[4+i*4+3];
+		}
+		const uint8_t* pixels = image.pixels();
+		for (int i = 0; i < image.w * image.h; i++) {
+			if (image.alpha[pixels[i]] == 0) {
+				image.transparent = true;
+				break;
+			}
 		}
-		int w = buf[0] << 8 | buf[1];
-		int h = buf[2] << 8 | buf[3];
+		return true;
+	}
+
+	// Draw a decoded image with copy_area, a few rows at a time
+	void Brain::draw_image(const Image& image, int x, int y, int32_t bgcolor) {
+		int w = image.w;
+		int h = image.h;
 
 		// Calculate the position to draw the image
 		int x0, y0;
@@ -330,61 +1041,84 @@ namespace adlib {
 			y0 = SCREEN_H + y - h;
 		}
 
-		//Read the palette
-		uint32_t old_eraser = pros::screen::get_eraser();
+		// Blend the palette with the background
+		bool opaque = !image.transparent;
 		if(bgcolor != 0xffffffff) {
-			pros::screen::set_eraser(bgcolor);
-			pros::screen::erase_rect(x0, y0, x0+w-1, y0+h-1);
-			pros::screen::set_eraser(old_eraser);
+			opaque = true;	// transparent pixels take the background color
 		}
 		else {
-			bgcolor = old_eraser;
+			bgcolor = pros::screen::get_eraser();
 		}
 
-		std::vector<uint32_t> palette(256);
-		std::vector<uint8_t> alpha(256);
-		int i;
-		for (i = 0; i < 256; i++) {
-			alpha[i] = buf[4+i*4+3];
-			if(alpha[i] != 255) {
-				buf[4+i*4]   = buf[4+i*4]   * alpha[i] /255 + (bgcolor >> 16 & 0xff) * (255 - alpha[i]) / 255;
-				buf[4+i*4+1] = buf[4+i*4+1] * alpha[i] /255 + (bgcolor >> 8 & 0xff) * (255 - alpha[i]) / 255;
-				buf[4+i*4+2] = buf[4+i*4+2] * alpha[i] /255 + (bgcolor & 0xff) * (255 - alpha[i]) / 255;
-			}
-			palette[i] = (buf[4+i*4] << 16) | (buf[4+i*4+1] << 8) | buf[4+i*4+2];
-		}
+		uint32_t palette[256];
+		image.blend_palette(bgcolor, palette);
 
-		// Read the image data and draw the pixels
-		int col = 0, row = 0, start;
-		while(row < h) {
-			if(col == 0 && row == 0) {
-				start = 4 + 1024;
-			}
-			else {
-				r = fread(buf.data(), 1, BUF_SIZE, file);
-				if(r == 0)	// End of file
-					break;
-				start = 0;
+		const uint8_t* pixels = image.pixels();
+		std::vector<uint32_t> rows(w * BLIT_ROWS);
+		if(opaque) {
+			for(int row = 0; row < h; row += BLIT_ROWS) {
+				int n = std::min(BLIT_ROWS, h - row);
+				for(int i = 0; i < w * n; i++) {
+					rows[i] = palette[pixels[row * w + i]];
+				}
+				pros::screen::copy_area(x0, y0 + row, x0 + w - 1, y0 + row + n - 1, rows.data(), w);
 			}
+			return;
+		}
 
-			for(i = start; i < r; i++) {
-				uint8_t index = buf[i];
-				if (alpha[index] != 0) {
-					pros::screen::set_pen(palette[index]);
-					pros::screen::draw_pixel(col + x0, row + y0);
+		// Leave fully transparent pixels untouched, copy the opaque runs of each row
+		for(int row = 0; row < h; row++) {
+			const uint8_t* line = &pixels[row * w];
+			int col = 0;
+			while(col < w) {
+				while(col < w && image.alpha[line[col]] == 0)
+					col++;
+				int start = col;
+				while(col < w && image.alpha[line[col]] != 0) {
+					rows[col - start] = palette[line[col]];
+					col++;
 				}
+				if(col > start)
+					pros::screen::copy_area(x0 + start, y0 + row, x0 + col - 1, y0 + row, rows.data(), col - start);
+			}
+		}
+	}
 
-				// update column and row
-				col++;
-				if (col >= w) {
-					col = 0;
-					row++;
-				}
+	// Palette with the alpha blended against bgcolor
+	void Image::blend_palette(uint32_t bgcolor, uint32_t* out) const {
+		for (int i = 0; i < 256; i++) {
+			uint32_t c = palette[i];
+			uint8_t a = alpha[i];
+			if(a != 255) {
+				uint32_t r = (c >> 16 & 0xff) * a / 255 + (bgcolor >> 16 & 0xff) * (255 - a) / 255;
+				uint32_t g = (c >> 8 & 0xff)  * a / 255 + (bgcolor >> 8 & 0xff)  * (255 - a) / 255;
+				uint32_t b = (c & 0xff)       * a / 255 + (bgcolor & 0xff)       * (255 - a) / 255;
+				c = (r << 16) | (g << 8) | b;
 			}
-			pros::delay(1); // Need break between fread from the SD card
+			out[i] = c;
 		}
-		fclose(file);
-		pros::delay(5);
+	}
+
+	// Decode an image file once and keep it in RAM, draw_image() then skips the SD card
+	bool Brain::cache_image(const char* filename) {
+		Image image;
+		if (!load_image(filename, image))
+			return false;
+		image_mutex.take(TIMEOUT_MAX);
+		images[filename] = std::move(image);
+		image_mutex.give();
+		return true;
+	}
+
+	void Brain::clear_image_cache() {
+		image_mutex.take(TIMEOUT_MAX);
+		images.clear();
+		image_mutex.give();
+	}
+
+	// Look images up in an open asset pack before the loose files on SD
+	void Brain::use_assets(AssetPack* pack) {
+		assets = pack;
 	}
 
 	// Draw a line
@@ -453,6 +1187,7 @@ namespace adlib {
 			this->radius = radius;
 		}
 		this->big = big;
+		layout();
 
 		Brain* parent = Brain::instance;
 		if(parent != nullptr) {
@@ -462,6 +1197,9 @@ namespace adlib {
 
 	// Draw the button on the screen
 	void Brain::Button::draw() {
+		static const uint16_t TRACE_ID = Trace::name("button_draw");
+		TraceScope trace(TRACE_ID);
+
 		uint32_t old_eraser = pros::screen::get_eraser();
 		pros::screen::set_eraser(bgcolor);
 		if(radius > 1) {
@@ -476,12 +1214,16 @@ namespace adlib {
 			pros::screen::erase_rect(x1, y1, x2, y2);
 		}
 
-		if(text.length() == 0) {
-			pros::screen::set_eraser(old_eraser);
+		draw_text(color);
+		pros::screen::set_eraser(old_eraser);
+	}
+
+	// Center the text lines in the button
+	void Brain::Button::layout() {
+		lines.clear();
+		if(text.length() == 0)
 			return;
-		}
 
-		pros::screen::set_pen(color);
 		int num_of_lines = std::count(text.begin(), text.end(), '\n') + 1;
 		std::istringstream iss(text);
 		std::string line;
@@ -489,24 +1231,70 @@ namespace adlib {
 			std::getline(iss, line);
 			size_t line_len = line.length();
 			if(line_len > 0) {
+				TextLine l;
 				if(this->big) {
-					int x0 = x1 + (x2 - x1 + 1 - line_len * FONT_W*2) / 2;
-					int y0 = y1 + (y2 - y1 + 1 - num_of_lines * (FONT_H*1.6-2)) / 2 + i * (FONT_H*1.6-2) + 2;
-					pros::screen::print(pros::E_TEXT_LARGE, x0, y0, line.c_str());
+					l.x = x1 + (x2 - x1 + 1 - line_len * FONT_W*2) / 2;
+					l.y = y1 + (y2 - y1 + 1 - num_of_lines * (FONT_H*1.6-2)) / 2 + i * (FONT_H*1.6-2) + 2;
 				}
 				else {
-					int x0 = x1 + (x2 - x1 + 1 - line_len * FONT_W) / 2;
-					int y0 = y1 + (y2 - y1 + 1 - num_of_lines * (FONT_H-2)) / 2 + i * (FONT_H-2) + 2;
-					pros::screen::print(pros::E_TEXT_MEDIUM, x0, y0, line.c_str());
+					l.x = x1 + (x2 - x1 + 1 - line_len * FONT_W) / 2;
+					l.y = y1 + (y2 - y1 + 1 - num_of_lines * (FONT_H-2)) / 2 + i * (FONT_H-2) + 2;
 				}
+				l.text = line;
+				lines.push_back(l);
 			}
 		}
-		pros::screen::set_eraser(old_eraser);
+	}
+
+	void Brain::Button::draw_text(uint32_t c) {
+		pros::screen::set_pen(c);
+		for(int i=0; i<lines.size(); i++) {
+			pros::screen::print(big ? pros::E_TEXT_LARGE : pros::E_TEXT_MEDIUM, lines[i].x, lines[i].y, lines[i].text.c_str());
+		}
+	}
+
+	// Keep the normal and pressed shapes in RAM, a touch then costs one copy_area and the text
+	void Brain::Button::prerender(uint32_t pressed_color, uint32_t pressed_bgcolor) {
+		this->pressed_color = pressed_color;
+		this->pressed_bgcolor = pressed_bgcolor;
+		outside_color = pros::screen::get_eraser();
+		render(normal_raster, bgcolor);
+		render(pressed_raster, pressed_bgcolor);
+		prerendered = true;
+	}
+
+	// Same shape as draw(): two rectangles and four corner circles
+	void Brain::Button::render(std::vector<uint32_t>& raster, uint32_t bg) {
+		int w = x2 - x1 + 1;
+		int h = y2 - y1 + 1;
+		raster.resize(w * h);
+		int r = radius - 1;
+		for(int y=0; y<h; y++) {
+			for(int x=0; x<w; x++) {
+				bool inside = true;
+				if(radius > 1 && (x < radius || x > w - 1 - radius) && (y < radius || y > h - 1 - radius)) {
+					int cx = (x < radius) ? radius : w - 1 - radius;
+					int cy = (y < radius) ? radius : h - 1 - radius;
+					inside = (x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r;
+				}
+				raster[y * w + x] = inside ? bg : outside_color;
+			}
+		}
+	}
+
+	// Swap between the prerendered normal and pressed looks, does nothing without prerender()
+	void Brain::Button::show_pressed(bool pressed) {
+		if(!prerendered)
+			return;
+		std::vector<uint32_t>& raster = pressed ? pressed_raster : normal_raster;
+		pros::screen::copy_area(x1, y1, x2, y2, raster.data(), x2 - x1 + 1);
+		draw_text(pressed ? pressed_color : color);
 	}
 
 	// Set the button text and redraw
 	void Brain::Button::set_text(const char* t) {
 		text = t;
+		layout();
 		draw();
 	}
 
@@ -519,6 +1307,9 @@ namespace adlib {
 	// Set the button background color and redraw
 	void Brain::Button::set_bgcolor(uint32_t bg) {
 		bgcolor = bg;
+		if(prerendered) {
+			render(normal_raster, bgcolor);
+		}
 		draw();
 	}
 
@@ -548,10 +1339,35 @@ namespace adlib {
 	}
 
 	double Distance::get_inches() {
-		if(!is_installed()) {
+		uint8_t port = get_port();
+		if(!IoStats::call(port, IoCall::IsInstalled, [this]() { return is_installed(); })) {
 			return 9999.0;
 		}
-		return get() / 25.4; // convert mm to inches
+		return IoStats::call(port, IoCall::DistanceGet, [this]() { return get(); }) / 25.4; // convert mm to inches
+	}
+
+	// Read the distance with the time it was acquired
+	Sample<double> Distance::read_inches() {
+		if(sampler_task != nullptr) {
+			Sample<double> s = sample.load();
+			if(s.time != 0)
+				return s;
+			// No reading from the sampler yet, read the sensor directly. acquire() keeps
+			// state for the sampler task, so it is left to the sampler.
+			return { get_inches(), pros::millis(), UPDATE_MS };
+		}
+		return acquire();
+	}
+
+	Sample<double> Distance::acquire() {
+		uint32_t now = pros::millis();
+		double d = get_inches();
+		// A changed value, or one period passed, means the sensor has updated
+		if(d != last_inches || now - last_time >= UPDATE_MS) {
+			last_inches = d;
+			last_time = now;
+		}
+		return { d, last_time, UPDATE_MS };
 	}
 
 	double Distance::distance_to_wall() {
@@ -566,27 +1382,2238 @@ namespace adlib {
 		return (sum - min - max) / 8;
 	}
 
-	/********************************************************/
-	ADIDigitalOut::ADIDigitalOut(uint8_t port)
-		: pros::ADIDigitalOut(port) {
+	// Start the sampler task, triggers and waiters are evaluated on every new reading
+	void Distance::start_task() {
+		if (sampler_task == nullptr) {
+			sampler_task = new pros::Task([this]() {
+				uint32_t now = pros::millis();
+				while (true) {
+					sampler_process();
+					pros::Task::delay_until(&now, SAMPLER_MS);
+				}
+			});
+		}
 	}
 
-	void ADIDigitalOut::reverse(bool status) {
-		is_reversed = status;
+	// Last reading taken by the sampler task
+	Sample<double> Distance::latest() {
+		return sample.load();
 	}
 
-	void ADIDigitalOut::press() {
-		set_value(is_reversed? false : true);
-		current_value = true;
-	}
+	void Distance::sampler_process() {
+		Sample<double> s = acquire();
+		if(s.time == sample_time)	// no new reading since the last poll
+			return;
+		sample_time = s.time;
+		sample.store(s);
 
-	void ADIDigitalOut::release() {
-		set_value(is_reversed? true : false);
-		current_value = false;
-	}
+		BlackBox* box = BlackBox::instance;
+		if(box != nullptr) {
+			box->record(RecordType::Distance, get_port(), s.value);
+		}
 
-	void ADIDigitalOut::toggle() {
-		current_value = !current_value;
-		set_value(is_reversed? !current_value : current_value);
+		take_added();
+		for(int i=0; i<on_sample.size(); i++) {
+			on_sample[i](s);
+		}
+
+		if(s.value >= 9999.0)	// sensor is not installed
+			return;
+
+		for(int i=0; i<triggers.size(); i++) {
+			evaluate_trigger(triggers[i], s);
+		}
+
+		for(int i=0; i<MAX_WAITERS; i++) {
+			Waiter& w = waiters[i];
+			if(!w.armed.load(std::memory_order_acquire))
+				continue;
+			bool met = w.below ? s.value < w.threshold : s.value > w.threshold;
+			if(met && w.armed.exchange(false)) {
+				pros::c::task_notify(w.task.load(std::memory_order_acquire));
+			}
+		}
+	}
+
+	// Call back once when the distance drops below inches, re-armed above inches + hysteresis
+	void Distance::below(double inches, std::function<void()> callback, double hysteresis, int debounce_ms) {
+		add_trigger(TRIGGER_BELOW, inches, callback, hysteresis, debounce_ms);
+	}
+
+	// Call back once when the distance rises above inches, re-armed below inches - hysteresis
+	void Distance::above(double inches, std::function<void()> callback, double hysteresis, int debounce_ms) {
+		add_trigger(TRIGGER_ABOVE, inches, callback, hysteresis, debounce_ms);
+	}
+
+	// Call back whenever the distance crosses inches in either direction
+	void Distance::crossing(double inches, std::function<void()> callback, double hysteresis, int debounce_ms) {
+		add_trigger(TRIGGER_CROSSING, inches, callback, hysteresis, debounce_ms);
+	}
+
+	void Distance::add_trigger(TriggerType type, double inches, std::function<void()> callback, double hysteresis, int debounce_ms) {
+		Trigger t;
+		t.type = type;
+		t.threshold = inches;
+		t.hysteresis = hysteresis;
+		t.debounce_ms = debounce_ms;
+		t.callback = callback;
+		added_mutex.take(TIMEOUT_MAX);
+		added_triggers.push_back(t);
+		added_mutex.give();
+	}
+
+	// Move newly added triggers and callbacks to the sampler's own lists, only the sampler task calls this
+	void Distance::take_added() {
+		added_mutex.take(TIMEOUT_MAX);
+		for(int i=0; i<added_triggers.size(); i++) {
+			triggers.push_back(added_triggers[i]);
+		}
+		added_triggers.clear();
+		for(int i=0; i<added_on_sample.size(); i++) {
+			on_sample.push_back(added_on_sample[i]);
+		}
+		added_on_sample.clear();
+		added_mutex.give();
+	}
+
+	void Distance::evaluate_trigger(Trigger& t, const Sample<double>& s) {
+		if(t.side == 0 && t.type != TRIGGER_CROSSING) {
+			t.side = -1;	// armed, fires right away if the condition already holds
+		}
+
+		// Which side of the hysteresis band the reading is on, keep the old side inside the band
+		int side = t.side;
+		if(t.type == TRIGGER_ABOVE) {
+			if(s.value > t.threshold) side = 1;
+			else if(s.value < t.threshold - t.hysteresis) side = -1;
+		}
+		else if(t.type == TRIGGER_BELOW) {
+			if(s.value < t.threshold) side = 1;
+			else if(s.value > t.threshold + t.hysteresis) side = -1;
+		}
+		else {
+			if(s.value > t.threshold + t.hysteresis / 2) side = 1;
+			else if(s.value < t.threshold - t.hysteresis / 2) side = -1;
+		}
+
+		if(t.side == 0) {	// a crossing trigger starts on the side of the first clear reading
+			t.side = side;
+			return;
+		}
+
+		if(side == t.side) {
+			t.pending = false;
+			return;
+		}
+
+		if(t.type != TRIGGER_CROSSING && side == -1) {	// released, re-arm silently
+			t.side = -1;
+			t.pending = false;
+			return;
+		}
+
+		if(!t.pending) {
+			t.pending = true;
+			t.pending_since = s.time;
+		}
+		if(s.time - t.pending_since >= (uint32_t)t.debounce_ms) {
+			t.side = side;
+			t.pending = false;
+			if(t.callback != nullptr) {
+				t.callback();
+			}
+		}
+	}
+
+	// Block the calling task until a reading is below inches, returns false on timeout
+	bool Distance::wait_below(double inches, uint32_t timeout) {
+		return wait_until(true, inches, timeout);
+	}
+
+	// Block the calling task until a reading is above inches, returns false on timeout
+	bool Distance::wait_above(double inches, uint32_t timeout) {
+		return wait_until(false, inches, timeout);
+	}
+
+	// Register a callback for every new reading, called on the sampler task
+	void Distance::sampled(std::function<void(const Sample<double>&)> callback) {
+		added_mutex.take(TIMEOUT_MAX);
+		added_on_sample.push_back(callback);
+		added_mutex.give();
+	}
+
+	bool Distance::wait_until(bool below, double inches, uint32_t timeout) {
+		start_task();
+
+		Sample<double> s = latest();
+		if(s.time != 0 && s.value < 9999.0 && (below ? s.value < inches : s.value > inches))
+			return true;
+
+		// Find a free waiter slot
+		pros::task_t self = pros::c::task_get_current();
+		Waiter* w = nullptr;
+		for(int i=0; i<MAX_WAITERS && w == nullptr; i++) {
+			pros::task_t expected = nullptr;
+			if(waiters[i].task.compare_exchange_strong(expected, self))
+				w = &waiters[i];
+		}
+		if(w == nullptr)
+			return false;
+
+		w->threshold = inches;
+		w->below = below;
+		w->armed.store(true, std::memory_order_release);
+
+		bool fired = false;
+		uint32_t start = pros::millis();
+		while(true) {
+			uint32_t elapsed = pros::millis() - start;
+			if(elapsed >= timeout)
+				break;
+			pros::Task::notify_take(true, timeout - elapsed);
+			if(!w->armed.load(std::memory_order_acquire)) {	// cleared by the sampler
+				fired = true;
+				break;
+			}
+		}
+		if(!fired) {
+			fired = !w->armed.exchange(false);	// the sampler may have fired just now
+		}
+		w->task.store(nullptr, std::memory_order_release);
+		return fired;
+	}
+
+	/********************************************************/
+	LatencyCompensator::LatencyCompensator(double latency_ms, double smoothing) {
+		this->latency_ms = latency_ms;
+		this->smoothing = smoothing;
+	}
+
+	// Feed a new sample, the velocity is estimated from consecutive readings
+	void LatencyCompensator::update(const Sample<double>& s) {
+		if(has_last && s.time != last.time) {
+			double v = (s.value - last.value) * 1000.0 / (s.time - last.time);
+			vel = smoothing * v + (1 - smoothing) * vel;
+		}
+		if(!has_last || s.time != last.time) {
+			last = s;
+			has_last = true;
+		}
+	}
+
+	// Estimated rate of change in units per second
+	double LatencyCompensator::velocity() {
+		return vel;
+	}
+
+	// Extrapolate the last sample to the given time
+	double LatencyCompensator::predict(uint32_t now) {
+		if(!has_last)
+			return 0;
+		double dt = (now - last.time + latency_ms) / 1000.0;
+		return last.value + vel * dt;
+	}
+
+	double LatencyCompensator::predict() {
+		return predict(pros::millis());
+	}
+
+	/********************************************************/
+	ObjectDetector::ObjectDetector(Distance& distance, pros::Optical& optical, double present_inches, double hysteresis)
+		: distance(distance), optical(optical) {
+		this->present_inches = present_inches;
+		this->hysteresis = hysteresis;
+	}
+
+	void ObjectDetector::set_red_hue(double min, double max) {
+		red_min = min;
+		red_max = max;
+	}
+
+	void ObjectDetector::set_blue_hue(double min, double max) {
+		blue_min = min;
+		blue_max = max;
+	}
+
+	void ObjectDetector::set_min_saturation(double s) {
+		min_saturation = s;
+	}
+
+	// Register a callback for when an object is detected, called with its color
+	void ObjectDetector::entered(std::function<void(ObjectColor)> callback) {
+		on_enter = callback;
+	}
+
+	// Register a callback for when the object leaves
+	void ObjectDetector::exited(std::function<void(ObjectColor)> callback) {
+		on_exit = callback;
+	}
+
+	// Hook into the distance sampler, call after registering the callbacks
+	void ObjectDetector::start() {
+		if(started)
+			return;
+		started = true;
+		distance.sampled([this](const Sample<double>& s) {
+			process(s);
+		});
+		distance.start_task();
+	}
+
+	ObjectStatus ObjectDetector::status() {
+		return published.load();
+	}
+
+	ObjectColor ObjectDetector::read_color() {
+		uint8_t port = optical.get_port();
+		if(IoStats::call(port, IoCall::OpticalGet, [this]() { return optical.get_saturation(); }, 0) < min_saturation)
+			return ObjectColor::None;
+
+		double hue = IoStats::call(port, IoCall::OpticalGet, [this]() { return optical.get_hue(); }, 1);
+		bool red = (red_min <= red_max) ? (hue >= red_min && hue <= red_max)
+										: (hue >= red_min || hue <= red_max);
+		if(red)
+			return ObjectColor::Red;
+		if(hue >= blue_min && hue <= blue_max)
+			return ObjectColor::Blue;
+		return ObjectColor::None;
+	}
+
+	void ObjectDetector::process(const Sample<double>& s) {
+		bool near = s.value < present_inches;
+		bool far = s.value > present_inches + hysteresis;
+
+		switch(state) {
+			case EMPTY:
+				if(!near)
+					break;
+				state = ENTERING;
+				current.entry_time = s.time;
+				red_votes = 0;
+				blue_votes = 0;
+				// fall through, this reading already counts as a vote
+			case ENTERING: {
+				if(far) {	// a glitch, not an object
+					state = EMPTY;
+					break;
+				}
+				ObjectColor c = read_color();
+				if(c == ObjectColor::Red) red_votes++;
+				if(c == ObjectColor::Blue) blue_votes++;
+				if(red_votes + blue_votes < COLOR_VOTES && s.time - current.entry_time < (uint32_t)(COLOR_VOTES * Distance::UPDATE_MS))
+					break;
+
+				state = PRESENT;
+				current.present = true;
+				if(red_votes > blue_votes)
+					current.color = ObjectColor::Red;
+				else if(blue_votes > red_votes)
+					current.color = ObjectColor::Blue;
+				else
+					current.color = ObjectColor::None;
+				published.store(current);
+				if(on_enter != nullptr) {
+					on_enter(current.color);
+				}
+				break;
+			}
+			case PRESENT:
+				if(far) {
+					state = LEAVING;
+					current.exit_time = s.time;
+				}
+				break;
+			case LEAVING:
+				if(!far) {	// still there
+					state = PRESENT;
+					break;
+				}
+				state = EMPTY;
+				current.present = false;
+				published.store(current);
+				if(on_exit != nullptr) {
+					on_exit(current.color);
+				}
+				break;
+		}
+	}
+
+	/********************************************************/
+	ADIDigitalOut::ADIDigitalOut(uint8_t port)
+		: pros::ADIDigitalOut(port) {
+		this->port = port;
+	}
+
+	void ADIDigitalOut::reverse(bool status) {
+		is_reversed = status;
+	}
+
+	void ADIDigitalOut::press() {
+		IoStats::call(IoStats::adi_port(port), IoCall::AdiWrite, [this]() { return set_value(is_reversed? false : true); });
+		current_value = true;
+		if(BlackBox::instance != nullptr) {
+			BlackBox::instance->record(RecordType::Digital, port, 1);
+		}
+	}
+
+	void ADIDigitalOut::release() {
+		IoStats::call(IoStats::adi_port(port), IoCall::AdiWrite, [this]() { return set_value(is_reversed? true : false); });
+		current_value = false;
+		if(BlackBox::instance != nullptr) {
+			BlackBox::instance->record(RecordType::Digital, port, 0);
+		}
+	}
+
+	void ADIDigitalOut::toggle() {
+		current_value = !current_value;
+		IoStats::call(IoStats::adi_port(port), IoCall::AdiWrite, [this]() { return set_value(is_reversed? !current_value : current_value); });
+		if(BlackBox::instance != nullptr) {
+			BlackBox::instance->record(RecordType::Digital, port, current_value);
+		}
+	}
+
+	/********************************************************/
+	pros::Task* ADIInput::adi_task = nullptr;
+
+	ADIInput::ADIInput(uint8_t port, int period_ms) {
+		this->port = port;
+		this->period_ms = period_ms;
+	}
+
+	ADIInput::~ADIInput() {
+		stop_sampling();
+	}
+
+	// The derived constructors call this last and their destructors call stop_sampling()
+	// first, so the ADI task never samples an input that is only partly built
+	void ADIInput::start_sampling() {
+		inputs_mutex().take(TIMEOUT_MAX);
+		inputs().push_back(this);
+		inputs_mutex().give();
+	}
+
+	// Waits for the current tick of the ADI task to finish
+	void ADIInput::stop_sampling() {
+		inputs_mutex().take(TIMEOUT_MAX);
+		std::vector<ADIInput*>& list = inputs();
+		for(int i=0; i<list.size(); i++) {
+			if(list[i] == this) {
+				list.erase(list.begin() + i);
+				break;
+			}
+		}
+		inputs_mutex().give();
+	}
+
+	// Function-local so global inputs can register before other globals are constructed
+	std::vector<ADIInput*>& ADIInput::inputs() {
+		static std::vector<ADIInput*> list;
+		return list;
+	}
+
+	// Held while the list changes and while the ADI task samples, so inputs may be created
+	// and destroyed at any time, but not from their own pressed/released callbacks
+	pros::Mutex& ADIInput::inputs_mutex() {
+		static pros::Mutex mutex;
+		return mutex;
+	}
+
+	void ADIInput::set_period(int ms) {
+		period_ms = ms;
+	}
+
+	// Start the shared ADI task, inputs created later are picked up on the next tick
+	void ADIInput::start_task() {
+		if (adi_task == nullptr) {
+			adi_task = new pros::Task([]() {
+				uint32_t now = pros::millis();
+				while (true) {
+					inputs_mutex().take(TIMEOUT_MAX);
+					std::vector<ADIInput*>& list = inputs();
+					for(int i=0; i<list.size(); i++) {
+						if(now - list[i]->last_sample >= (uint32_t)list[i]->period_ms) {
+							list[i]->last_sample = now;
+							list[i]->sample(now);
+						}
+					}
+					inputs_mutex().give();
+					pros::Task::delay_until(&now, TICK_MS);
+				}
+			});
+		}
+	}
+
+	/********************************************************/
+	ADIDigitalIn::ADIDigitalIn(uint8_t port, int debounce_ms, int period_ms)
+		: pros::ADIDigitalIn(port), ADIInput(port, period_ms) {
+		this->debounce_ms = debounce_ms;
+		start_sampling();
+	}
+
+	ADIDigitalIn::~ADIDigitalIn() {
+		stop_sampling();
+	}
+
+	// Debounced state from the last sample
+	bool ADIDigitalIn::is_pressed() {
+		return state.load();
+	}
+
+	// True once for every press since the last call
+	bool ADIDigitalIn::get_new_press() {
+		return new_press.exchange(false);
+	}
+
+	// Register a callback for when the switch is pressed, called on the ADI task
+	void ADIDigitalIn::pressed(std::function<void()> callback) {
+		on_press = callback;
+	}
+
+	// Register a callback for when the switch is released, called on the ADI task
+	void ADIDigitalIn::released(std::function<void()> callback) {
+		on_release = callback;
+	}
+
+	void ADIDigitalIn::sample(uint32_t now) {
+		bool raw = IoStats::call(IoStats::adi_port(port), IoCall::AdiRead, [this]() { return pros::ADIDigitalIn::get_value(); });
+		if(raw != raw_state) {
+			raw_state = raw;
+			raw_since = now;
+		}
+		if(raw_state == state.load() || now - raw_since < (uint32_t)debounce_ms)
+			return;
+
+		state.store(raw_state);
+		if(raw_state) {
+			new_press.store(true);
+			if(on_press != nullptr) {
+				on_press();
+			}
+		}
+		else if(on_release != nullptr) {
+			on_release();
+		}
+	}
+
+	/********************************************************/
+	ADIAnalogIn::ADIAnalogIn(uint8_t port, int oversample, double smoothing, int period_ms)
+		: pros::ADIAnalogIn(port), ADIInput(port, period_ms) {
+		this->oversample = std::max(1, std::min(oversample, MAX_OVERSAMPLE));
+		this->smoothing = smoothing;
+		start_sampling();
+	}
+
+	ADIAnalogIn::~ADIAnalogIn() {
+		stop_sampling();
+	}
+
+	// Take the current value as zero, the sensor must be at rest (blocks about 500 msec)
+	double ADIAnalogIn::calibrate() {
+		zero = pros::ADIAnalogIn::calibrate();
+		return zero;
+	}
+
+	// Units per count for get_value_calibrated()
+	void ADIAnalogIn::set_scale(double units_per_count) {
+		scale = units_per_count;
+	}
+
+	// Filtered value from the last sample, 0 - 4095
+	double ADIAnalogIn::get_value() {
+		return value.load();
+	}
+
+	double ADIAnalogIn::get_value_calibrated() {
+		return (value.load() - zero) * scale;
+	}
+
+	void ADIAnalogIn::sample(uint32_t now) {
+		int32_t raw = IoStats::call(IoStats::adi_port(port), IoCall::AdiRead, [this]() { return pros::ADIAnalogIn::get_value(); });
+		window_sum += raw - window[win_ptr];
+		window[win_ptr] = raw;
+		win_ptr = (win_ptr + 1) % oversample;
+		if(win_cnt < oversample) {
+			win_cnt++;
+		}
+
+		double avg = (double)window_sum / win_cnt;
+		if(win_cnt == 1)
+			filtered = avg;
+		else
+			filtered = smoothing * avg + (1 - smoothing) * filtered;
+		value.store(filtered);
+	}
+}
+
+/********************************************************/
+/* Motor                                                */
+/********************************************************/
+namespace adlib {
+	Motor::Motor(int8_t port)
+		: pros::Motor(port) {
+	}
+
+	// Read the motor telemetry once and publish it to other tasks, writers are serialized so any task may call it
+	MotorTelemetry Motor::sample() {
+		int port = abs(get_port());	// negative when reversed
+		sample_mutex.take(TIMEOUT_MAX);
+		MotorTelemetry t = IoStats::call(port, IoCall::MotorTelemetry, [this]() {
+			MotorTelemetry t;
+			t.time = pros::millis();
+			t.current = get_current_draw();
+			t.velocity = get_actual_velocity();
+			t.voltage = get_voltage();
+			t.temperature = get_temperature();
+			return t;
+		});
+		last.store(t);
+		sample_mutex.give();
+
+		BlackBox* box = BlackBox::instance;
+		if(box != nullptr) {
+			box->record(RecordType::Motor, port, t.current);
+		}
+		return t;
+	}
+
+	// Last published telemetry, no device access
+	MotorTelemetry Motor::telemetry() {
+		return last.load();
+	}
+
+	/********************************************************/
+	JamDetector::JamDetector(Motor& motor, double current_threshold, double velocity_threshold, int stall_ms)
+		: motor(motor) {
+		this->current_threshold = current_threshold;
+		this->velocity_threshold = velocity_threshold;
+		this->current_release = current_threshold * 0.8;
+		this->velocity_release = velocity_threshold * 2;
+		this->stall_ms = stall_ms;
+	}
+
+	// Set the levels at which a detected jam is considered cleared
+	void JamDetector::set_hysteresis(double current_release, double velocity_release) {
+		this->current_release = current_release;
+		this->velocity_release = velocity_release;
+	}
+
+	// Register a callback for when a jam is detected
+	void JamDetector::jammed(std::function<void()> callback) {
+		on_jam = callback;
+	}
+
+	// Register a callback for when a jam is cleared
+	void JamDetector::cleared(std::function<void()> callback) {
+		on_clear = callback;
+	}
+
+	bool JamDetector::is_jammed() {
+		return jam;
+	}
+
+	// Feed one telemetry sample, callbacks are called from the caller's task
+	void JamDetector::update(const MotorTelemetry& t) {
+		// update the rolling window
+		current_sum += t.current - current_buf[win_ptr];
+		velocity_sum += fabs(t.velocity) - velocity_buf[win_ptr];
+		current_buf[win_ptr] = t.current;
+		velocity_buf[win_ptr] = fabs(t.velocity);
+		win_ptr = (win_ptr + 1) % WINDOW;
+		if(win_cnt < WINDOW) {
+			win_cnt++;
+			return;
+		}
+
+		double current = current_sum / WINDOW;
+		double velocity = velocity_sum / WINDOW;
+
+		if(!jam) {
+			if(current > current_threshold && velocity < velocity_threshold) {
+				if(!stalling) {
+					stalling = true;
+					stall_start = t.time;
+				}
+				else if(t.time - stall_start >= (uint32_t)stall_ms) {
+					jam = true;
+					if(on_jam != nullptr) {
+						on_jam();
+					}
+				}
+			}
+			else {
+				stalling = false;
+			}
+		}
+		else if(current < current_release || velocity > velocity_release) {
+			jam = false;
+			stalling = false;
+			if(on_clear != nullptr) {
+				on_clear();
+			}
+		}
+	}
+
+	// Start the detector task, sample the motor on every telemetry update
+	void JamDetector::start_task() {
+		if (detector_task == nullptr) {
+			detector_task = new pros::Task([this]() {
+				uint32_t now = pros::millis();
+				while (true) {
+					update(motor.sample());
+					pros::Task::delay_until(&now, Motor::UPDATE_MS);
+				}
+			});
+		}
+	}
+}
+
+/********************************************************/
+/* Characterization                                     */
+/********************************************************/
+namespace adlib {
+	Characterizer::Characterizer(const std::vector<Motor*>& motors, size_t capacity)
+		: motors(motors), capacity(capacity) {
+		samples.reserve(capacity);
+	}
+
+	// Slow ramp where acceleration is close to zero, mostly measures ks and kv
+	void Characterizer::set_quasistatic(double ramp_mv_per_s, int duration_ms) {
+		this->ramp_mv_per_s = ramp_mv_per_s;
+		ramp_ms = duration_ms;
+	}
+
+	// Voltage step from rest, mostly measures ka
+	void Characterizer::set_dynamic(double step_mv, int duration_ms) {
+		this->step_mv = step_mv;
+		step_ms = duration_ms;
+	}
+
+	void Characterizer::cancel() {
+		cancelled.set();
+	}
+
+	void Characterizer::apply(double mv) {
+		for (Motor* m : motors) {
+			m->move_voltage((int32_t)mv);
+		}
+	}
+
+	// Run all four tests and fit the result, blocks for about 20 seconds with the defaults.
+	// Returns false when cancelled or the buffer filled up, the samples so far are kept.
+	bool Characterizer::run() {
+		samples.clear();
+		cancelled.clear();
+		bool ok = test([this](uint32_t t) { return ramp_mv_per_s * t / 1000.0; }, ramp_ms) &&
+				  test([this](uint32_t t) { return -ramp_mv_per_s * t / 1000.0; }, ramp_ms) &&
+				  test([this](uint32_t t) { return step_mv; }, step_ms) &&
+				  test([this](uint32_t t) { return -step_mv; }, step_ms);
+		fit();
+		return ok;
+	}
+
+	// Drive the group with voltage_at(ms since the start) and record the response
+	bool Characterizer::test(std::function<double(uint32_t)> voltage_at, int duration_ms) {
+		size_t first = samples.size();
+		uint32_t start = pros::millis();
+		uint32_t now = start;
+		bool ok = true;
+		while (now - start < (uint32_t)duration_ms) {
+			if (cancelled.test() || samples.size() >= capacity) {
+				ok = false;
+				break;
+			}
+			apply(std::max(-12000.0, std::min(12000.0, voltage_at(now - start))));
+
+			double voltage = 0, velocity = 0;
+			for (Motor* m : motors) {
+				MotorTelemetry t = m->sample();
+				voltage += t.voltage;
+				velocity += t.velocity;
+			}
+			samples.push_back({now, (float)(voltage / motors.size() / 1000.0), (float)(velocity / motors.size()), 0});
+			pros::Task::delay_until(&now, Motor::UPDATE_MS);
+		}
+		apply(0);
+
+		// Acceleration from the velocity a few samples either side, the motor velocity is noisy
+		const size_t half = 2;
+		size_t n = samples.size();
+		for (size_t i = first; i < n; i++) {
+			size_t lo = (i >= first + half) ? i - half : first;
+			size_t hi = std::min(n - 1, i + half);
+			uint32_t dt = samples[hi].time - samples[lo].time;
+			samples[i].accel = (dt > 0) ? (samples[hi].velocity - samples[lo].velocity) * 1000.0 / dt : 0;
+		}
+
+		pros::delay(SETTLE_MS);
+		return ok;
+	}
+
+	// Least squares over the moving samples, solves the 3x3 normal equations
+	Feedforward Characterizer::fit() {
+		double ata[3][3] = {};
+		double atb[3] = {};
+		double sum_v = 0, sum_vv = 0;
+		int n = 0;
+		for (auto& s : samples) {
+			if (fabs(s.velocity) < 1)
+				continue;	// not moving yet, static friction is not in the model
+			double row[3] = {(s.velocity > 0) ? 1.0 : -1.0, s.velocity, s.accel};
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++)
+					ata[i][j] += row[i] * row[j];
+				atb[i] += row[i] * s.voltage;
+			}
+			sum_v += s.voltage;
+			sum_vv += s.voltage * s.voltage;
+			n++;
+		}
+
+		Feedforward f;
+		f.samples = n;
+		// Gaussian elimination with partial pivoting
+		for (int c = 0; c < 3; c++) {
+			int pivot = c;
+			for (int r = c + 1; r < 3; r++) {
+				if (fabs(ata[r][c]) > fabs(ata[pivot][c]))
+					pivot = r;
+			}
+			if (fabs(ata[pivot][c]) < 1e-9) {
+				result = f;		// not enough distinct samples
+				return result;
+			}
+			for (int j = 0; j < 3; j++)
+				std::swap(ata[c][j], ata[pivot][j]);
+			std::swap(atb[c], atb[pivot]);
+			for (int r = c + 1; r < 3; r++) {
+				double k = ata[r][c] / ata[c][c];
+				for (int j = c; j < 3; j++)
+					ata[r][j] -= k * ata[c][j];
+				atb[r] -= k * atb[c];
+			}
+		}
+		double x[3];
+		for (int r = 2; r >= 0; r--) {
+			double v = atb[r];
+			for (int j = r + 1; j < 3; j++)
+				v -= ata[r][j] * x[j];
+			x[r] = v / ata[r][r];
+		}
+		f.ks = x[0];
+		f.kv = x[1];
+		f.ka = x[2];
+
+		double ss_res = 0;
+		for (auto& s : samples) {
+			if (fabs(s.velocity) < 1)
+				continue;
+			double e = s.voltage - (f.ks * ((s.velocity > 0) ? 1 : -1) + f.kv * s.velocity + f.ka * s.accel);
+			ss_res += e * e;
+		}
+		double ss_tot = sum_vv - sum_v * sum_v / n;
+		f.r2 = (ss_tot > 0) ? 1 - ss_res / ss_tot : 0;
+		result = f;
+		return result;
+	}
+
+	// Write the samples to SD, to fit again on the host with a different model
+	bool Characterizer::dump(const char* filename) {
+		if (!pros::usd::is_installed())
+			return false;
+		FILE* file = fopen(filename, "w");
+		if (file == nullptr)
+			return false;
+		fprintf(file, "# ks=%g kv=%g ka=%g r2=%.4f\n", result.ks, result.kv, result.ka, result.r2);
+		fprintf(file, "time,voltage,velocity,accel\n");
+		for (size_t i = 0; i < samples.size(); i++) {
+			Sample& s = samples[i];
+			fprintf(file, "%u,%.3f,%.2f,%.1f\n", (unsigned)s.time, s.voltage, s.velocity, s.accel);
+			if (i % 256 == 255)
+				pros::delay(1);	// Need break between writes to the SD card
+		}
+		fclose(file);
+		return true;
+	}
+
+	// Save the fitted constants as <prefix>.ks, <prefix>.kv and <prefix>.ka
+	void Characterizer::store(Config& config, const char* prefix) {
+		std::string p = prefix;
+		config.set(p + ".ks", result.ks);
+		config.set(p + ".kv", result.kv);
+		config.set(p + ".ka", result.ka);
+		config.save();
+	}
+}
+
+/********************************************************/
+/* Power manager                                        */
+/********************************************************/
+namespace adlib {
+	PowerManager::PowerManager(double budget_ma, double min_voltage_mv)
+		: max_budget(budget_ma), min_voltage(min_voltage_mv) {
+		allowed.store(budget_ma);
+	}
+
+	// Higher priority groups are served first, every motor always keeps min_ma
+	void PowerManager::add(const std::vector<Motor*>& motors, int priority, int min_ma, int max_ma) {
+		Group g;
+		g.motors = motors;
+		g.priority = priority;
+		g.min_ma = min_ma;
+		g.max_ma = max_ma;
+		g.applied.assign(motors.size(), max_ma);
+		g.cap.assign(motors.size(), max_ma);
+		g.need.assign(motors.size(), max_ma);
+		g.grant.assign(motors.size(), max_ma);
+		groups.push_back(g);
+		std::stable_sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+			return a.priority > b.priority;
+		});
+	}
+
+	void PowerManager::set_thermal(double derate_c, double cutoff_c) {
+		this->derate_c = derate_c;
+		this->cutoff_c = cutoff_c;
+	}
+
+	double PowerManager::battery_voltage() {
+		return voltage.load();
+	}
+
+	double PowerManager::resistance() {
+		return ohms.load();
+	}
+
+	// Voltage drop in mV if current_ma more is drawn
+	double PowerManager::predicted_sag(double current_ma) {
+		return current_ma * ohms.load();
+	}
+
+	double PowerManager::budget() {
+		return allowed.load();
+	}
+
+	int PowerManager::limit_events() {
+		return events.load();
+	}
+
+	// One tick: read the battery, size the budget, split it and send the changed limits
+	void PowerManager::update() {
+		double v = pros::battery::get_voltage();
+		double i = pros::battery::get_current();
+		if (voltage.load() == 0) {
+			voltage.store(v);
+			current.store(i);
+			last_v = v;
+			last_i = i;
+		}
+		voltage.store(voltage.load() * 0.8 + v * 0.2);
+		current.store(current.load() * 0.8 + i * 0.2);
+
+		// Internal resistance from the voltage change when the load steps
+		if (fabs(i - last_i) > 1000) {
+			double r = -(v - last_v) / (i - last_i);
+			if (r > 0.005 && r < 0.5)
+				ohms.store(ohms.load() * 0.9 + r * 0.1);
+			last_v = v;
+			last_i = i;
+		}
+
+		// Total current that keeps the predicted voltage above min_voltage
+		double r = ohms.load();
+		double open_circuit = voltage.load() + current.load() * r;
+		double total = std::min(max_budget, std::max(0.0, (open_circuit - min_voltage) / r));
+		allowed.store(total);
+
+		// Thermal caps and demand from cached telemetry, sampled here only when no other task
+		// does (Motor::sample() serializes its writers). A motor needs its measured draw plus
+		// headroom, so a motor pushing against its limit asks for more on the next tick.
+		double reserved = 0;
+		uint32_t now = pros::millis();
+		for (auto& g : groups) {
+			for (size_t k = 0; k < g.motors.size(); k++) {
+				MotorTelemetry t = g.motors[k]->telemetry();
+				if (now - t.time > 2 * Motor::UPDATE_MS)
+					t = g.motors[k]->sample();
+				double f = (t.temperature - derate_c) / (cutoff_c - derate_c);
+				f = std::max(0.0, std::min(1.0, f));
+				g.cap[k] = g.max_ma - (int)(f * (g.max_ma - g.min_ma));
+				int need = (int)(fabs(t.current) * 1.25) + HEADROOM_MA;
+				g.need[k] = std::max(g.min_ma, std::min(g.cap[k], need));
+				reserved += g.min_ma;
+			}
+		}
+
+		// Minimum for everyone, then what each motor draws by priority, then whatever is
+		// left up to the caps, again by priority
+		double spare = std::max(0.0, total - reserved);
+		for (auto& g : groups) {
+			double want = 0;
+			for (size_t k = 0; k < g.motors.size(); k++)
+				want += g.need[k] - g.min_ma;
+			double share = (want > 0) ? std::min(1.0, spare / want) : 0;
+			spare -= share * want;
+			for (size_t k = 0; k < g.motors.size(); k++)
+				g.grant[k] = g.min_ma + (int)(share * (g.need[k] - g.min_ma));
+		}
+		for (auto& g : groups) {
+			double want = 0;
+			for (size_t k = 0; k < g.motors.size(); k++)
+				want += g.cap[k] - g.grant[k];
+			double share = (want > 0) ? std::min(1.0, spare / want) : 0;
+			spare -= share * want;
+
+			for (size_t k = 0; k < g.motors.size(); k++) {
+				int limit = g.grant[k] + (int)(share * (g.cap[k] - g.grant[k]));
+				if (abs(limit - g.applied[k]) < HYSTERESIS_MA && limit != g.cap[k])
+					continue;
+				if (limit == g.applied[k])
+					continue;
+				g.motors[k]->set_current_limit(limit);
+				if (limit < g.max_ma && g.applied[k] >= g.max_ma)
+					events++;		// motor went from unlimited to limited
+				g.applied[k] = limit;
+
+				BlackBox* box = BlackBox::instance;
+				if (box != nullptr)
+					box->record(RecordType::CurrentLimit, abs(g.motors[k]->get_port()), limit);
+			}
+		}
+	}
+
+	void PowerManager::start_task() {
+		if (power_task == nullptr) {
+			power_task = new pros::Task([this]() {
+				uint32_t now = pros::millis();
+				while (true) {
+					update();
+					pros::Task::delay_until(&now, UPDATE_MS);
+				}
+			});
+		}
+	}
+}
+
+/********************************************************/
+/* Black box                                            */
+/********************************************************/
+namespace adlib {
+	// Create the first file of pattern ("..._%02d...") that is not on the card yet, so files
+	// from earlier sessions are kept. index is where the search starts and is left past the
+	// file used. Returns nullptr when all 100 names are taken.
+	static FILE* open_new_file(const char* pattern, int& index) {
+		char filename[40];
+		for (; index < 100; index++) {
+			snprintf(filename, sizeof(filename), pattern, index);
+			FILE* file = fopen(filename, "r");
+			if (file != nullptr) {
+				fclose(file);
+				continue;
+			}
+			index++;
+			return fopen(filename, "w");
+		}
+		return nullptr;
+	}
+
+	BlackBox* BlackBox::instance = nullptr;
+
+	BlackBox::BlackBox(size_t capacity)
+		: records(capacity) {
+		BlackBox::instance = this;
+	}
+
+	// Add a record, safe from any task, ignored while frozen
+	void BlackBox::record(RecordType type, uint16_t id, float value) {
+		if(frozen.test())
+			return;
+		uint32_t n = head.fetch_add(1, std::memory_order_relaxed);
+		Record& r = records[n % records.size()];
+		r.time = pros::millis();
+		r.id = id;
+		r.type = type;
+		r.value = value;
+	}
+
+	// Freeze the buffer and let the black box task write it to SD
+	void BlackBox::trigger(const char* reason) {
+		if(triggered.test_and_set())
+			return;		// another task triggered first, its reason is kept
+		snprintf(this->reason, sizeof(this->reason), "%s", reason);
+		frozen.set();
+		pros::task_t t = box_handle.load();
+		if(t != nullptr)
+			pros::c::task_notify(t);
+	}
+
+	// Start recording again after a dump
+	void BlackBox::rearm() {
+		head.store(0);
+		dumped.clear();
+		frozen.clear();
+		triggered.clear();
+	}
+
+	bool BlackBox::is_frozen() {
+		return frozen.test();
+	}
+
+	// Trigger when kick() is not called for timeout_ms, 0 disables the watchdog
+	void BlackBox::watchdog(uint32_t timeout_ms) {
+		last_kick.store(pros::millis());
+		watchdog_ms = timeout_ms;
+	}
+
+	void BlackBox::kick() {
+		last_kick.store(pros::millis());
+	}
+
+	// Trigger when Brain::self_check() reports one of the devices disconnected
+	void BlackBox::monitor(const std::vector<DeviceInfo>& devices) {
+		this->devices = devices;
+	}
+
+	// Trigger when both buttons are held together
+	void BlackBox::chord(Controller& controller, int button1, int button2) {
+		controller.chord_pressed(button1, button2, [this]() {
+			trigger("button");
+		});
+	}
+
+	// Start the black box task, it watches the triggers and writes the dump
+	void BlackBox::start_task() {
+		if (box_task == nullptr) {
+			box_task = new pros::Task([this]() {
+				box_handle.store(pros::c::task_get_current());
+				while (true) {
+					if(!frozen.test()) {
+						uint32_t now = pros::millis();
+						if(watchdog_ms > 0 && now - last_kick.load() > watchdog_ms) {
+							trigger("watchdog");
+						}
+						else if(devices.size() > 0 && Brain::instance != nullptr) {
+							std::string err = Brain::instance->self_check(devices);
+							if(err.length() > 0 && devices_ok)
+								trigger(err.c_str());
+							devices_ok = (err.length() == 0);
+						}
+					}
+
+					if(frozen.test() && !dumped.test()) {
+						dump();
+						dumped.set();
+					}
+					pros::Task::notify_take(true, MONITOR_MS);
+				}
+			});
+		}
+	}
+
+	// Write the frozen records to SD, oldest first
+	void BlackBox::dump() {
+		if (!pros::usd::is_installed())
+			return;
+
+		FILE* file = open_new_file("/usd/blackbox_%02d.csv", dump_cnt);
+		if (file == nullptr)
+			return;
+
+		uint32_t n = head.load();
+		uint32_t cap = records.size();
+		uint32_t first = (n > cap) ? n - cap : 0;
+		fprintf(file, "# trigger: %s at %u\n", reason, (unsigned)pros::millis());
+		fprintf(file, "time,type,id,value\n");
+		for(uint32_t i = first; i < n; i++) {
+			Record& r = records[i % cap];
+			fprintf(file, "%u,%d,%d,%g\n", (unsigned)r.time, (int)r.type, (int)r.id, r.value);
+			if((i - first) % 256 == 255)
+				pros::delay(1);	// Need break between writes to the SD card
+		}
+		fclose(file);
+	}
+}
+
+/********************************************************/
+/* Benchmark                                            */
+/********************************************************/
+namespace adlib {
+	Benchmark::Benchmark(Brain& brain, Controller& controller)
+		: brain(brain), controller(controller) {
+	}
+
+	// Add a call to time, fn is called iterations times. setup and teardown run once
+	// before and after the case and are not timed.
+	void Benchmark::add(const char* name, int iterations, std::function<void()> fn,
+						std::function<void()> setup, std::function<void()> teardown) {
+		Case c;
+		c.name = name;
+		c.iterations = iterations;
+		c.fn = fn;
+		c.setup = setup;
+		c.teardown = teardown;
+		cases.push_back(c);
+	}
+
+	// Add the PROS primitives and adlib calls we care about, skip the ones without a device
+	void Benchmark::add_defaults(Distance* distance, const char* image, const std::vector<DeviceInfo>& devices) {
+		add("get_digital", 1000, [this]() {
+			controller.get_digital(pros::E_CONTROLLER_DIGITAL_A);
+		});
+		// button_process() would fire the user callbacks from this task, time the read it is made of
+		add("is_button_pressed", 1000, [this]() {
+			controller.is_button_pressed(BUTTON_A);
+		});
+		add("draw_pixel", 1000, []() {
+			pros::screen::draw_pixel(10, 10);
+		});
+		add("copy_area 32x32", 200, []() {
+			static uint32_t block[32 * 32];
+			pros::screen::copy_area(0, 0, 31, 31, block, 32);
+		});
+		add("screen print", 200, []() {
+			pros::screen::print(pros::E_TEXT_MEDIUM, 10, 10, "0123456789");
+		});
+		if (pros::usd::is_installed()) {
+			add("fread 512B", 200, [this]() {
+				static uint8_t buf[512];
+				if (scratch != nullptr && fread(buf, 1, sizeof(buf), scratch) < sizeof(buf))
+					rewind(scratch);
+			}, [this]() {
+				// 64KB scratch file, read in a loop
+				static uint8_t buf[512];
+				FILE* file = fopen("/usd/bench.tmp", "wb");
+				if (file == nullptr)
+					return;
+				for (int i = 0; i < 128; i++)
+					fwrite(buf, 1, sizeof(buf), file);
+				fclose(file);
+				scratch = fopen("/usd/bench.tmp", "rb");
+			}, [this]() {
+				if (scratch != nullptr)
+					fclose(scratch);
+				scratch = nullptr;
+				remove("/usd/bench.tmp");
+			});
+		}
+		if (distance != nullptr) {
+			add("distance get", 1000, [distance]() {
+				distance->get();
+			});
+		}
+		if (image != nullptr) {
+			std::string name = image;
+			add("draw_image", 3, [this, name]() {
+				brain.draw_image(name.c_str());
+			});
+		}
+		if (devices.size() > 0) {
+			add("self_check", 50, [this, devices]() {
+				brain.self_check(devices);
+			});
+		}
+	}
+
+	// Run the benchmark in the background when the button is pressed
+	void Benchmark::attach(Brain::Button& button) {
+		button.pressed([this]() {
+			if (running.test())
+				return;
+			running.set();
+			if (bench_task != nullptr)
+				delete bench_task;
+			bench_task = new pros::Task([this]() {
+				run();
+			});
+		});
+	}
+
+	// Time every case and report, blocks until done. The screen is cleared afterwards.
+	void Benchmark::run() {
+		running.set();
+		for (int i = 0; i < cases.size(); i++) {
+			Case& c = cases[i];
+			c.max_us = 0;
+			if (c.setup)
+				c.setup();
+			uint64_t start = pros::micros();
+			for (int n = 0; n < c.iterations; n++) {
+				uint64_t t0 = pros::micros();
+				c.fn();
+				uint32_t dt = pros::micros() - t0;
+				if (dt > c.max_us)
+					c.max_us = dt;
+			}
+			c.mean_us = (double)(pros::micros() - start) / c.iterations;
+			if (c.teardown)
+				c.teardown();
+			pros::delay(10);	// let other tasks run between cases
+		}
+
+		brain.clear_screen(0x000000);
+		for (int i = 0; i < cases.size(); i++) {
+			brain.print(i, 0, 0xffffff, "%-16s %9.1f us  max %6u us", cases[i].name.c_str(), cases[i].mean_us, (unsigned)cases[i].max_us);
+		}
+		write_report();
+		running.clear();
+	}
+
+	void Benchmark::write_report() {
+		if (!pros::usd::is_installed())
+			return;
+
+		FILE* file = fopen("/usd/bench.txt", "w");
+		if (file == nullptr)
+			return;
+		fprintf(file, "name,iterations,mean_us,max_us\n");
+		for (int i = 0; i < cases.size(); i++) {
+			fprintf(file, "%s,%d,%.2f,%u\n", cases[i].name.c_str(), cases[i].iterations, cases[i].mean_us, (unsigned)cases[i].max_us);
+		}
+		fclose(file);
+	}
+}
+
+/********************************************************/
+/* Step timing                                          */
+/********************************************************/
+namespace adlib {
+	StepTimer::StepTimer(const char* filename)
+		: filename(filename) {
+	}
+
+	void StepTimer::begin_run() {
+		if (!loaded) {
+			load();
+			loaded = true;
+		}
+		step_cnt.store(0);
+		run_start = pros::millis();
+	}
+
+	// Returns the step to pass to end(), or -1 when the buffer is full
+	int StepTimer::begin(const char* name) {
+		int i = step_cnt.fetch_add(1);
+		if (i >= MAX_STEPS)
+			return -1;
+		steps[i].name = name;
+		steps[i].end = 0;
+		steps[i].start = pros::millis();
+		return i;
+	}
+
+	void StepTimer::end(int step) {
+		if (step >= 0 && step < MAX_STEPS)
+			steps[step].end = std::max(pros::millis(), steps[step].start + 1);
+	}
+
+	// Find each step's slack, fold the run into the totals and write them to SD
+	void StepTimer::end_run() {
+		uint32_t now = pros::millis();
+		int n = std::min(step_cnt.load(), MAX_STEPS);
+		run_ms = now - run_start;
+
+		int pred[MAX_STEPS];
+		uint32_t latest[MAX_STEPS];		// latest finish that does not delay the run
+		int order[MAX_STEPS];
+		for (int i = 0; i < n; i++) {
+			if (steps[i].end == 0)
+				steps[i].end = now;		// still running, counts to the end of the run
+			latest[i] = now;
+			order[i] = i;
+			pred[i] = -1;
+			for (int j = 0; j < n; j++) {
+				if (j != i && steps[j].end != 0 && steps[j].end <= steps[i].start + GATE_MS &&
+					(pred[i] < 0 || steps[j].end > steps[pred[i]].end))
+					pred[i] = j;
+			}
+		}
+
+		// Successors start after their gate, so walking by start time backwards
+		// settles every step before its gate is visited
+		std::sort(order, order + n, [this](int a, int b) {
+			return steps[a].start > steps[b].start;
+		});
+		for (int k = 0; k < n; k++) {
+			int i = order[k];
+			int p = pred[i];
+			if (p >= 0) {
+				uint32_t duration = steps[i].end - steps[i].start;
+				uint32_t lf = (latest[i] > duration) ? latest[i] - duration : 0;
+				latest[p] = std::min(latest[p], lf);
+			}
+		}
+
+		for (auto& s : stats)
+			s.critical = false;
+		for (int i = 0; i < n; i++) {
+			double duration = steps[i].end - steps[i].start;
+			double slack = (latest[i] > steps[i].end) ? latest[i] - steps[i].end : 0;
+			Stats& s = find(steps[i].name);
+			s.n++;
+			double d = duration - s.mean;
+			s.mean += d / s.n;
+			s.m2 += d * (duration - s.mean);
+			s.slack += (slack - s.slack) / s.n;
+			if (slack <= GATE_MS)
+				s.critical = true;
+		}
+		save();
+	}
+
+	StepTimer::Stats& StepTimer::find(const char* name) {
+		for (auto& s : stats) {
+			if (s.name == name)
+				return s;
+		}
+		stats.push_back(Stats());
+		stats.back().name = name;
+		return stats.back();
+	}
+
+	// Slowest steps first, * marks the critical path of the last run
+	void StepTimer::show(Brain& brain) {
+		std::vector<Stats> sorted = stats;
+		std::sort(sorted.begin(), sorted.end(), [](const Stats& a, const Stats& b) {
+			return a.mean > b.mean;
+		});
+		brain.clear_screen(0x000000);
+		// 48 columns and 12 rows fit on the screen, lines are kept to 47 characters
+		brain.print(0, 0, 0xffffff, "last run %u ms", (unsigned)run_ms);
+		brain.print(1, 0, 0xffffff, "  %-20s %8s %7s %7s", "step", "mean ms", "sd", "slack");
+		for (int i = 0; i < sorted.size() && i < 10; i++) {
+			Stats& s = sorted[i];
+			double sd = (s.n > 1) ? sqrt(s.m2 / (s.n - 1)) : 0;
+			brain.print(i + 2, 0, s.critical ? 0xff8000 : 0xffffff, "%c %-20.20s %8.0f %7.0f %7.0f",
+						s.critical ? '*' : ' ', s.name.c_str(), s.mean, sd, s.slack);
+		}
+	}
+
+	void StepTimer::load() {
+		FILE* file = fopen(filename.c_str(), "r");
+		if (file == nullptr)
+			return;
+		char line[96];
+		while (fgets(line, sizeof(line), file) != nullptr) {
+			Stats s;
+			char name[40];
+			int critical;
+			if (sscanf(line, "%39[^,],%d,%lf,%lf,%lf,%d", name, &s.n, &s.mean, &s.m2, &s.slack, &critical) == 6) {
+				s.name = name;
+				s.critical = critical;
+				stats.push_back(s);
+			}
+		}
+		fclose(file);
+	}
+
+	void StepTimer::save() {
+		if (!pros::usd::is_installed())
+			return;
+		FILE* file = fopen(filename.c_str(), "w");
+		if (file == nullptr)
+			return;
+		fprintf(file, "name,n,mean,m2,slack,critical\n");
+		for (auto& s : stats) {
+			fprintf(file, "%s,%d,%.3f,%.3f,%.3f,%d\n", s.name.c_str(), s.n, s.mean, s.m2, s.slack, s.critical ? 1 : 0);
+		}
+		fclose(file);
+	}
+}
+
+/********************************************************/
+/* Asset pack                                           */
+/********************************************************/
+namespace adlib {
+	AssetPack::~AssetPack() {
+		close();
+	}
+
+	// Read the header and the index, the file stays open for later reads
+	bool AssetPack::open(const char* filename) {
+		close();
+		if (!pros::usd::is_installed())
+			return false;
+		file = fopen(filename, "rb");
+		if (file == nullptr)
+			return false;
+
+		uint32_t header[4];
+		if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+			memcmp(header, "ADPK", 4) != 0 || header[1] != VERSION ||
+			header[2] == 0 || (header[2] & (header[2] - 1)) != 0) {
+			close();
+			return false;
+		}
+
+		index.resize(header[2]);
+		size_t bytes = index.size() * sizeof(Slot);
+		if (fread(index.data(), 1, bytes, file) != bytes) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void AssetPack::close() {
+		if (file != nullptr) {
+			fclose(file);
+			file = nullptr;
+		}
+		index.clear();
+	}
+
+	bool AssetPack::is_open() {
+		return file != nullptr;
+	}
+
+	// FNV-1a, 0 marks an empty slot so it is never returned
+	uint32_t AssetPack::hash(const char* name) {
+		uint32_t h = 2166136261u;
+		while (*name != '\0') {
+			h ^= (uint8_t)*name++;
+			h *= 16777619u;
+		}
+		return h != 0 ? h : 1;
+	}
+
+	const AssetPack::Slot* AssetPack::find(const char* name) {
+		if (index.size() == 0)
+			return nullptr;
+		uint32_t h = hash(name);
+		uint32_t mask = index.size() - 1;
+		for (uint32_t i = 0; i < index.size(); i++) {
+			const Slot& slot = index[(h + i) & mask];
+			if (slot.hash == h)
+				return &slot;
+			if (slot.hash == 0)
+				return nullptr;
+		}
+		return nullptr;
+	}
+
+	bool AssetPack::contains(const char* name) {
+		return find(name) != nullptr;
+	}
+
+	// Read a whole asset with one seek and one sequential read
+	bool AssetPack::load(const char* name, std::vector<uint8_t>& data) {
+		const Slot* slot = find(name);
+		if (slot == nullptr)
+			return false;
+
+		data.resize(slot->size);
+		mutex.take(TIMEOUT_MAX);
+		bool ok = fseek(file, slot->offset, SEEK_SET) == 0 &&
+				  fread(data.data(), 1, slot->size, file) == slot->size;
+		mutex.give();
+		return ok;
+	}
+
+	// Pack loose SD files into one asset pack, each asset is named by its file name.
+	// Run once on the robot, or write the same layout with a host script.
+	bool AssetPack::build(const char* filename, const std::vector<std::string>& files) {
+		if (!pros::usd::is_installed())
+			return false;
+
+		uint32_t slots = 1;
+		while (slots < files.size() * 2)	// keep the table at most half full
+			slots <<= 1;
+		std::vector<Slot> table(slots);
+		memset(table.data(), 0, slots * sizeof(Slot));
+
+		FILE* out = fopen(filename, "wb");
+		if (out == nullptr)
+			return false;
+
+		uint32_t header[4] = { 0, VERSION, slots, (uint32_t)files.size() };
+		memcpy(header, "ADPK", 4);
+		fwrite(header, 1, sizeof(header), out);
+		fwrite(table.data(), 1, slots * sizeof(Slot), out);	// placeholder, rewritten at the end
+
+		uint32_t offset = sizeof(header) + slots * sizeof(Slot);
+		std::vector<uint8_t> buf(2048);
+		bool ok = true;
+		for (int i = 0; i < files.size() && ok; i++) {
+			FILE* in = fopen(files[i].c_str(), "rb");
+			if (in == nullptr) {
+				ok = false;
+				break;
+			}
+
+			// Pad up to the next block
+			uint32_t aligned = (offset + ALIGN - 1) / ALIGN * ALIGN;
+			for (; offset < aligned; offset++)
+				fputc(0, out);
+
+			uint32_t size = 0;
+			size_t r;
+			while ((r = fread(buf.data(), 1, buf.size(), in)) > 0) {
+				fwrite(buf.data(), 1, r, out);
+				size += r;
+				pros::delay(1);	// Need break between fread from the SD card
+			}
+			fclose(in);
+
+			uint32_t h = hash(files[i].c_str());
+			uint32_t j = h & (slots - 1);
+			while (table[j].hash != 0) {
+				if (table[j].hash == h)	// two names with the same hash
+					ok = false;
+				j = (j + 1) & (slots - 1);
+			}
+			table[j].hash = h;
+			table[j].offset = offset;
+			table[j].size = size;
+			offset += size;
+		}
+
+		fseek(out, sizeof(header), SEEK_SET);
+		fwrite(table.data(), 1, slots * sizeof(Slot), out);
+		fclose(out);
+		return ok;
+	}
+}
+
+/********************************************************/
+/* Config                                               */
+/********************************************************/
+namespace adlib {
+	Config::Config(const char* filename) {
+		this->filename = filename;
+	}
+
+	// Read the file, lines starting with # are comments
+	bool Config::load() {
+		if (!pros::usd::is_installed())
+			return false;
+		FILE* file = fopen(filename.c_str(), "r");
+		if (file == nullptr)
+			return false;
+
+		std::string text;
+		char buf[256];
+		size_t r;
+		while ((r = fread(buf, 1, sizeof(buf), file)) > 0) {
+			text.append(buf, r);
+		}
+		fclose(file);
+		parse(text.c_str(), text.length());
+		return true;
+	}
+
+	// Read the file from an asset pack, looked up by the same file name
+	bool Config::load(AssetPack& pack) {
+		std::vector<uint8_t> data;
+		if (!pack.load(filename.c_str(), data))
+			return false;
+		parse((const char*)data.data(), data.size());
+		return true;
+	}
+
+	void Config::parse(const char* text, size_t len) {
+		mutex.take(TIMEOUT_MAX);
+		entries.clear();
+		size_t start = 0;
+		while (start < len) {
+			size_t end = start;
+			while (end < len && text[end] != '\n')
+				end++;
+			std::string l(text + start, end - start);
+			start = end + 1;
+
+			l.erase(l.find_last_not_of(" \r") + 1);
+			size_t eq = l.find('=');
+			if (l.length() == 0 || l[0] == '#' || eq == std::string::npos)
+				continue;
+			entries[l.substr(0, eq)] = l.substr(eq + 1);
+		}
+		mutex.give();
+		loaded.store(true);
+	}
+
+	bool Config::save() {
+		if (!pros::usd::is_installed())
+			return false;
+		FILE* file = fopen(filename.c_str(), "w");
+		if (file == nullptr)
+			return false;
+
+		mutex.take(TIMEOUT_MAX);
+		for (auto& e : entries) {
+			fprintf(file, "%s=%s\n", e.first.c_str(), e.second.c_str());
+		}
+		mutex.give();
+		fclose(file);
+		return true;
+	}
+
+	bool Config::is_loaded() {
+		return loaded.load();
+	}
+
+	double Config::get(const std::string& key, double default_value) {
+		std::string v = get_string(key);
+		if (v.length() == 0)
+			return default_value;
+		return atof(v.c_str());
+	}
+
+	std::string Config::get_string(const std::string& key, const std::string& default_value) {
+		mutex.take(TIMEOUT_MAX);
+		auto it = entries.find(key);
+		std::string v = (it != entries.end()) ? it->second : default_value;
+		mutex.give();
+		return v;
+	}
+
+	void Config::set(const std::string& key, double value) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.6g", value);
+		set_string(key, buf);
+	}
+
+	void Config::set_string(const std::string& key, const std::string& value) {
+		mutex.take(TIMEOUT_MAX);
+		entries[key] = value;
+		mutex.give();
+	}
+}
+
+/********************************************************/
+/* Prewarm                                              */
+/********************************************************/
+namespace adlib {
+	// Register a job, register all jobs before start_task()
+	void Prewarm::add(const char* name, Job job) {
+		JobStruct* j = new JobStruct();
+		j->name = name;
+		j->job = job;
+		jobs.push_back(j);
+	}
+
+	// Decode an image into the Brain image cache
+	void Prewarm::add_image(const char* filename) {
+		std::string name = filename;
+		add(filename, [name](const std::function<bool()>& cancelled) {
+			Brain* brain = Brain::instance;
+			return brain != nullptr && brain->cache_image(name.c_str());
+		});
+	}
+
+	// Start the distance sampler and wait for its first readings
+	void Prewarm::add_sampler(Distance& distance) {
+		add("distance sampler", [&distance](const std::function<bool()>& cancelled) {
+			distance.start_task();
+			uint32_t start = pros::millis();
+			while (distance.latest().time == 0 || pros::millis() - start < 3 * Distance::UPDATE_MS) {
+				if (cancelled() || pros::millis() - start > 1000)
+					return false;
+				pros::delay(Distance::UPDATE_MS);
+			}
+			return true;
+		});
+	}
+
+	void Prewarm::add_config(Config& config) {
+		add("config", [&config](const std::function<bool()>& cancelled) {
+			return config.load();
+		});
+	}
+
+	// Start the prewarm task, pending jobs run while the robot is disabled
+	// and are cancelled as soon as autonomous or driver control starts
+	void Prewarm::start_task() {
+		if (prewarm_task == nullptr) {
+			prewarm_task = new pros::Task([this]() {
+				std::function<bool()> cancelled = []() {
+					return !pros::competition::is_disabled();
+				};
+				while (true) {
+					for (int i = 0; i < jobs.size() && !cancelled(); i++) {
+						if (jobs[i]->state.load() == JOB_PENDING)
+							run_job(i, cancelled);
+					}
+					pros::delay(POLL_MS);
+				}
+			}, TASK_PRIORITY_DEFAULT - 2);
+		}
+	}
+
+	// Run every pending job now on the calling task, for use outside a match
+	void Prewarm::run() {
+		std::function<bool()> cancelled = []() {
+			return false;
+		};
+		for (int i = 0; i < jobs.size(); i++) {
+			if (jobs[i]->state.load() == JOB_PENDING)
+				run_job(i, cancelled);
+		}
+	}
+
+	bool Prewarm::run_job(int i, const std::function<bool()>& cancelled) {
+		JobStruct* j = jobs[i];
+		uint32_t start = pros::millis();
+		bool ok = j->job(cancelled);
+		j->duration = pros::millis() - start;
+		if (cancelled())	// interrupted by a mode change, try again next time
+			return false;
+		j->state.store(ok ? JOB_DONE : JOB_FAILED);
+		return ok;
+	}
+
+	// True when every job is done
+	bool Prewarm::is_ready() {
+		for (int i = 0; i < jobs.size(); i++) {
+			if (jobs[i]->state.load() != JOB_DONE)
+				return false;
+		}
+		return true;
+	}
+
+	// One line per job: name, state and time spent
+	std::string Prewarm::report() {
+		std::string r;
+		for (int i = 0; i < jobs.size(); i++) {
+			int state = jobs[i]->state.load();
+			const char* s = (state == JOB_DONE) ? "ok" : (state == JOB_FAILED) ? "FAILED" : "pending";
+			char line[64];
+			snprintf(line, sizeof(line), "%-20s %-7s %4u ms\n", jobs[i]->name.c_str(), s, (unsigned)jobs[i]->duration);
+			r += line;
+		}
+		return r;
+	}
+}
+
+/********************************************************/
+/* Field map                                            */
+/********************************************************/
+namespace adlib {
+	FieldMap::FieldMap(Brain& brain, const char* background, int x, int y, double field_inches)
+		: brain(brain) {
+		this->background_file = background;
+		this->x0 = x;
+		this->y0 = y;
+		this->field_inches = field_inches;
+	}
+
+	// Decode the field image into RAM and draw it
+	bool FieldMap::initialize() {
+		Image image;
+		if (!brain.load_image(background_file.c_str(), image))
+			return false;
+
+		w = image.w;
+		h = image.h;
+		scale = w / field_inches;
+		uint32_t palette[256];
+		image.blend_palette(pros::screen::get_eraser(), palette);
+		background.resize(w * h);
+		const uint8_t* pixels = image.pixels();
+		for (int i = 0; i < w * h; i++) {
+			background[i] = palette[pixels[i]];
+		}
+
+		pros::screen::copy_area(x0, y0, x0 + w - 1, y0 + h - 1, background.data(), w);
+		has_old = false;
+		return true;
+	}
+
+	void FieldMap::set_robot(double size_inches, uint32_t color, uint32_t heading_color) {
+		robot_inches = size_inches;
+		robot_color = color;
+		this->heading_color = heading_color;
+	}
+
+	// Restore the old footprint from the cached field and draw the new one
+	void FieldMap::update(const Pose& pose) {
+		if (background.size() == 0)
+			return;
+
+		// Robot center and half size vectors in map pixels, screen y grows down
+		double cx = pose.x * scale;
+		double cy = h - 1 - pose.y * scale;
+		double half = robot_inches * scale / 2;
+		float rad = pose.theta * FAST_PI / 180;
+		double fx = fast_sin(rad) * half, fy = -fast_cos(rad) * half;	// forward
+		double sx = -fy, sy = fx;							// side
+
+		double px[4] = { cx + fx + sx, cx + fx - sx, cx - fx - sx, cx - fx + sx };
+		double py[4] = { cy + fy + sy, cy + fy - sy, cy - fy - sy, cy - fy + sy };
+		Rect r = { w, h, -1, -1 };
+		for (int i = 0; i < 4; i++) {
+			r.x1 = std::min(r.x1, (int)floor(px[i]));
+			r.y1 = std::min(r.y1, (int)floor(py[i]));
+			r.x2 = std::max(r.x2, (int)ceil(px[i]));
+			r.y2 = std::max(r.y2, (int)ceil(py[i]));
+		}
+		r.x1 = std::max(r.x1, 0);
+		r.y1 = std::max(r.y1, 0);
+		r.x2 = std::min(r.x2, w - 1);
+		r.y2 = std::min(r.y2, h - 1);
+
+		bool visible = (r.x1 <= r.x2 && r.y1 <= r.y2);
+
+		if (has_old) {
+			bool overlap = visible && !(old_rect.x2 < r.x1 || r.x2 < old_rect.x1 || old_rect.y2 < r.y1 || r.y2 < old_rect.y1);
+			if (overlap) {	// one blit covers both the old and the new footprint
+				Rect u = { std::min(r.x1, old_rect.x1), std::min(r.y1, old_rect.y1),
+						   std::max(r.x2, old_rect.x2), std::max(r.y2, old_rect.y2) };
+				render(u, px, py, cx, cy, fx, fy);
+				old_rect = r;
+				return;
+			}
+			// Restore the old box straight from the cached field
+			pros::screen::copy_area(x0 + old_rect.x1, y0 + old_rect.y1, x0 + old_rect.x2, y0 + old_rect.y2,
+									&background[old_rect.y1 * w + old_rect.x1], w);
+			has_old = false;
+		}
+
+		if (!visible)	// robot is off the map
+			return;
+		render(r, px, py, cx, cy, fx, fy);
+		old_rect = r;
+		has_old = true;
+	}
+
+	// Compose the field and the robot for one box in RAM and blit it
+	void FieldMap::render(const Rect& r, const double* px, const double* py, double hx, double hy, double fx, double fy) {
+		int rw = r.x2 - r.x1 + 1;
+		int rh = r.y2 - r.y1 + 1;
+		scratch.resize(rw * rh);
+		for (int y = 0; y < rh; y++) {
+			memcpy(&scratch[y * rw], &background[(r.y1 + y) * w + r.x1], rw * sizeof(uint32_t));
+		}
+
+		// Fill the footprint, a pixel is inside when it is on the same side of all four edges
+		for (int y = 0; y < rh; y++) {
+			for (int x = 0; x < rw; x++) {
+				double qx = r.x1 + x + 0.5, qy = r.y1 + y + 0.5;
+				int pos = 0, neg = 0;
+				for (int i = 0; i < 4; i++) {
+					int j = (i + 1) % 4;
+					double c = (px[j] - px[i]) * (qy - py[i]) - (py[j] - py[i]) * (qx - px[i]);
+					if (c >= 0) pos++;
+					if (c <= 0) neg++;
+				}
+				if (pos == 4 || neg == 4)
+					scratch[y * rw + x] = robot_color;
+			}
+		}
+
+		// Heading line from the center to the front edge
+		int steps = (int)ceil(std::max(fabs(fx), fabs(fy)));
+		for (int i = 0; i <= steps; i++) {
+			int x = (int)(hx + (steps > 0 ? fx * i / steps : 0)) - r.x1;
+			int y = (int)(hy + (steps > 0 ? fy * i / steps : 0)) - r.y1;
+			if (x >= 0 && x < rw && y >= 0 && y < rh)
+				scratch[y * rw + x] = heading_color;
+		}
+
+		pros::screen::copy_area(x0 + r.x1, y0 + r.y1, x0 + r.x2, y0 + r.y2, scratch.data(), rw);
+	}
+}
+
+/********************************************************/
+/* Path recorder                                        */
+/********************************************************/
+namespace adlib {
+	PathRecorder::PathRecorder(std::function<Pose()> odometry, int period_ms, int max_seconds)
+		: odometry(odometry), period_ms(period_ms) {
+		capacity = (size_t)max_seconds * 1000 / period_ms;
+		raw.reserve(capacity);
+	}
+
+	// The chord starts a recording, and stops it when pressed again
+	void PathRecorder::chord(Controller& controller, int button1, int button2) {
+		controller.chord_pressed(button1, button2, [this]() {
+			if (is_recording())
+				stop();
+			else
+				start();
+		});
+	}
+
+	// Returns false while the last recording is still being simplified
+	bool PathRecorder::start() {
+		if (busy.test())
+			return false;
+		want.set();
+		return true;
+	}
+
+	void PathRecorder::stop() {
+		want.clear();
+	}
+
+	bool PathRecorder::is_recording() {
+		return want.test();
+	}
+
+	bool PathRecorder::is_busy() {
+		return busy.test();
+	}
+
+	void PathRecorder::set_tolerance(double inches, double degrees) {
+		tolerance = inches;
+		heading_tolerance = degrees;
+	}
+
+	// Last simplified path
+	std::vector<PathPoint> PathRecorder::path() {
+		table_mutex.take(TIMEOUT_MAX);
+		std::vector<PathPoint> p = table;
+		table_mutex.give();
+		return p;
+	}
+
+	// The sample task reads the pose at a fixed rate, the simplify task runs below the
+	// default priority so it never delays the drive code
+	void PathRecorder::start_task() {
+		if (simplify_task == nullptr) {
+			simplify_task = new pros::Task([this]() {
+				while (true) {
+					pros::Task::notify_take(true, TIMEOUT_MAX);
+					if (busy.test()) {
+						simplify();
+						save();
+						busy.clear();
+					}
+				}
+			}, TASK_PRIORITY_DEFAULT - 2);
+		}
+		if (sample_task == nullptr) {
+			sample_task = new pros::Task([this]() {
+				bool active = false;
+				uint32_t start_time = 0;
+				uint32_t now = pros::millis();
+				while (true) {
+					if (!active && want.test() && !busy.test()) {
+						raw.clear();
+						start_time = now;
+						active = true;
+					}
+					if (active) {
+						Pose p = odometry();
+						raw.push_back({now - start_time, (float)p.x, (float)p.y, (float)p.theta, 0});
+						if (raw.size() >= capacity)
+							want.clear();	// buffer full, end the recording here
+						if (!want.test()) {
+							active = false;
+							busy.set();
+							simplify_task->notify();
+						}
+					}
+					pros::Task::delay_until(&now, period_ms);
+				}
+			});
+		}
+	}
+
+	// Ramer-Douglas-Peucker on the raw samples. A point is kept when it is off the line
+	// between its neighbors by more than the position or heading tolerance, so turns in
+	// place survive. Uses a stack instead of recursion to keep the task stack small.
+	void PathRecorder::simplify() {
+		size_t n = raw.size();
+		std::vector<PathPoint> out;
+		if (n > 0) {
+			std::vector<uint8_t> keep(n, 0);
+			keep[0] = keep[n - 1] = 1;
+			std::vector<std::pair<size_t, size_t>> stack;
+			stack.push_back({0, n - 1});
+			while (!stack.empty()) {
+				size_t a = stack.back().first;
+				size_t b = stack.back().second;
+				stack.pop_back();
+				if (b <= a + 1)
+					continue;
+
+				const PathPoint& pa = raw[a];
+				const PathPoint& pb = raw[b];
+				double dx = pb.x - pa.x, dy = pb.y - pa.y;
+				double len2 = dx * dx + dy * dy;
+				double turn = remainder(pb.theta - pa.theta, 360.0);
+				double worst = 0;
+				size_t index = a;
+				for (size_t i = a + 1; i < b; i++) {
+					const PathPoint& p = raw[i];
+					double t = (len2 > 0) ? ((p.x - pa.x) * dx + (p.y - pa.y) * dy) / len2 : 0;
+					t = std::max(0.0, std::min(1.0, t));
+					double ex = p.x - (pa.x + t * dx);
+					double ey = p.y - (pa.y + t * dy);
+					double f = (double)(i - a) / (b - a);
+					double eh = fabs(remainder(p.theta - (pa.theta + f * turn), 360.0));
+					double err = std::max(sqrt(ex * ex + ey * ey) / tolerance, eh / heading_tolerance);
+					if (err > worst) {
+						worst = err;
+						index = i;
+					}
+				}
+				if (worst > 1) {
+					keep[index] = 1;
+					stack.push_back({a, index});
+					stack.push_back({index, b});
+				}
+			}
+
+			// Speed over a few samples around each kept point
+			const size_t half = 2;
+			for (size_t i = 0; i < n; i++) {
+				if (!keep[i])
+					continue;
+				PathPoint p = raw[i];
+				size_t lo = (i > half) ? i - half : 0;
+				size_t hi = std::min(n - 1, i + half);
+				uint32_t dt = raw[hi].time - raw[lo].time;
+				if (dt > 0) {
+					double dist = 0;
+					for (size_t j = lo; j < hi; j++) {
+						dist += hypot(raw[j + 1].x - raw[j].x, raw[j + 1].y - raw[j].y);
+					}
+					p.velocity = dist * 1000.0 / dt;
+				}
+				out.push_back(p);
+			}
+		}
+
+		table_mutex.take(TIMEOUT_MAX);
+		table.swap(out);
+		table_mutex.give();
+	}
+
+	// Write the path to SD and print it to the terminal as a table to paste into code
+	void PathRecorder::save() {
+		std::vector<PathPoint> p = path();
+		FILE* file = pros::usd::is_installed() ? open_new_file("/usd/path_%02d.csv", path_cnt) : nullptr;
+		if (file != nullptr)
+			printf("// /usd/path_%02d.csv: %d points from %d samples\n", path_cnt - 1, (int)p.size(), (int)raw.size());
+		else
+			printf("// path, not saved: %d points from %d samples\n", (int)p.size(), (int)raw.size());
+		for (auto& pt : p) {
+			printf("{%u, %.2f, %.2f, %.1f, %.1f},\n", (unsigned)pt.time, pt.x, pt.y, pt.theta, pt.velocity);
+		}
+
+		if (file == nullptr)
+			return;
+		fprintf(file, "time,x,y,theta,velocity\n");
+		for (auto& pt : p) {
+			fprintf(file, "%u,%.2f,%.2f,%.1f,%.1f\n", (unsigned)pt.time, pt.x, pt.y, pt.theta, pt.velocity);
+		}
+		fclose(file);
+	}
+
+	// Read a path written by save(), for the follower
+	bool PathRecorder::load(const char* filename, std::vector<PathPoint>& path) {
+		FILE* file = fopen(filename, "r");
+		if (file == nullptr)
+			return false;
+		path.clear();
+		char line[96];
+		while (fgets(line, sizeof(line), file) != nullptr) {
+			PathPoint p;
+			unsigned t;
+			if (sscanf(line, "%u,%f,%f,%f,%f", &t, &p.x, &p.y, &p.theta, &p.velocity) == 5) {
+				p.time = t;
+				path.push_back(p);
+			}
+		}
+		fclose(file);
+		return path.size() > 0;
+	}
+}
+
+/********************************************************/
+/* Console                                              */
+/********************************************************/
+namespace adlib {
+	Console::Console(int x, int y, int w, int rows, uint32_t color, uint32_t bgcolor)
+		: history(rows) {
+		this->x = x;
+		this->y = y;
+		this->w = w;
+		this->rows = rows;
+		this->color = color;
+		this->bgcolor = bgcolor;
+	}
+
+	// Queue a line for the console task, it is dropped if the queue is full
+	void Console::log(const char* fmt, ...) {
+		va_list args;
+		va_start(args, fmt);
+		bool ok = queue.emplace([&](Line& line) {
+			vsnprintf(line.text, MAX_LINE_LEN, fmt, args);
+		});
+		va_end(args);
+		if (!ok)
+			num_dropped++;
+	}
+
+	// Lines lost because logging was faster than the screen
+	int Console::dropped() {
+		return num_dropped.load();
+	}
+
+	// Start the console task, queued lines are drawn once per frame
+	void Console::start_task() {
+		if (console_task == nullptr) {
+			console_task = new pros::Task([this]() {
+				redraw();
+				while (true) {
+					render();
+					pros::delay(FRAME_MS);
+				}
+			});
+		}
+	}
+
+	// Draw the whole region from the history
+	void Console::redraw() {
+		uint32_t old_eraser = pros::screen::get_eraser();
+		pros::screen::set_eraser(bgcolor);
+		pros::screen::erase_rect(x, y, x + w - 1, y + rows * LINE_H - 1);
+		pros::screen::set_eraser(old_eraser);
+		for (int i = 0; i < num_of_lines; i++) {
+			draw_line(i, history[(history_ptr + i) % rows].text);
+		}
+	}
+
+	void Console::draw_line(int row, const char* text) {
+		pros::screen::set_pen(color);
+		pros::screen::print(pros::E_TEXT_MEDIUM, x, y + row * LINE_H, "%s", text);
+	}
+
+	// Scroll the region once for all new lines and draw only the new lines
+	void Console::render() {
+		int prev = num_of_lines;	// lines on the screen before this frame
+		Line line;
+		int count = 0;
+		while (count < rows && queue.pop(line)) {	// at most one screen of lines per frame
+			if (num_of_lines < rows) {
+				history[num_of_lines++] = line;
+			}
+			else {
+				history[history_ptr] = line;
+				history_ptr = (history_ptr + 1) % rows;
+			}
+			count++;
+		}
+		if (count == 0)
+			return;
+
+		int scroll = std::max(0, prev + count - rows);
+		if (prev > 0 && scroll >= prev) {	// every old line is pushed out
+			redraw();
+			return;
+		}
+
+		uint32_t old_eraser = pros::screen::get_eraser();
+		pros::screen::set_eraser(bgcolor);
+		if (scroll > 0) {
+			pros::screen::scroll_area(x, y, x + w - 1, y + rows * LINE_H - 1, scroll * LINE_H);
+		}
+		int first = prev - scroll;	// screen row of the first new line
+		pros::screen::erase_rect(x, y + first * LINE_H, x + w - 1, y + (first + count) * LINE_H - 1);
+		pros::screen::set_eraser(old_eraser);
+		for (int i = 0; i < count; i++) {
+			draw_line(first + i, history[(history_ptr + first + i) % rows].text);
+		}
 	}
 }
@@ -10,6 +10,201 @@
 #include "pros/misc.hpp"
 #include "pros/rtos.hpp"
 #include "pros/distance.hpp"
+#include "pros/motors.hpp"
+#include "pros/optical.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <type_traits>
+
+#define ADLIB_YIELD() pros::delay(1)
+#include "adlib_lockfree.h"
+#include "adlib_fastmath.h"
+
+namespace adlib {
+	// Bounded queue, producers post from any task and wake the waiting consumer task
+	template <typename T, size_t N>
+	class EventQueue {
+	public:
+		bool post(const T& event) {
+			if(!ring.push(event))
+				return false;	// full, the event is dropped
+			pros::task_t t = waiter.load(std::memory_order_acquire);
+			if(t != nullptr)
+				pros::c::task_notify(t);
+			return true;
+		}
+
+		// Wait up to timeout msec for an event, only the consumer task may call wait()
+		bool wait(T& event, uint32_t timeout = TIMEOUT_MAX) {
+			if(ring.pop(event))
+				return true;
+			waiter.store(pros::c::task_get_current(), std::memory_order_release);
+			uint32_t start = pros::millis();
+			while(!ring.pop(event)) {
+				uint32_t elapsed = pros::millis() - start;
+				if(elapsed >= timeout || pros::Task::notify_take(true, timeout - elapsed) == 0) {
+					if(!ring.pop(event)) {
+						waiter.store(nullptr, std::memory_order_release);
+						return false;
+					}
+					break;
+				}
+			}
+			waiter.store(nullptr, std::memory_order_release);
+			return true;
+		}
+
+		bool poll(T& event) {
+			return ring.pop(event);
+		}
+
+	private:
+		MpscRing<T, N> ring;
+		std::atomic<pros::task_t> waiter{nullptr};
+	};
+}
+
+/********************************************************/
+/* Timeline tracing                                     */
+/********************************************************/
+namespace adlib {
+	// Begin/end/instant events recorded into a ring buffer per task, dumped as Chrome trace JSON
+	class Trace {
+	public:
+		static uint16_t name(const char* s);
+		static void begin(uint16_t id);
+		static void end(uint16_t id);
+		static void instant(uint16_t id);
+		static void enable(bool on);
+		static bool dump(const char* filename = "/usd/trace.json");
+
+		static constexpr int MAX_TASKS = 8;
+		static constexpr int MAX_NAMES = 64;
+		static constexpr uint16_t UNKNOWN_NAME = MAX_NAMES - 1;	// reserved, returned once the names run out
+		static constexpr int EVENTS_PER_TASK = 1024;	// power of 2
+
+	private:
+		enum {
+			EV_BEGIN = 'B',
+			EV_END = 'E',
+			EV_INSTANT = 'i'
+		};
+
+		struct Event {
+			uint32_t time_us;
+			uint16_t name;
+			uint8_t type;
+		};
+
+		// Written only by its owner task
+		struct Buffer {
+			std::atomic<pros::task_t> owner{nullptr};
+			char task_name[32] = "";	// copied on claim, the task may be gone by the dump
+			std::atomic<uint32_t> head{0};
+			Event events[EVENTS_PER_TASK];
+		};
+
+		static void add(uint8_t type, uint16_t id);
+		static Buffer* buffer();
+
+		static Buffer buffers[MAX_TASKS];
+		static std::atomic<uint32_t> dropped;	// events with no buffer left
+		static const char* names[MAX_NAMES];	// names must be string literals
+		static std::atomic<int> num_of_names;
+		static AtomicFlag enabled;
+	};
+
+	// Trace the lifetime of a scope
+	class TraceScope {
+	public:
+		TraceScope(uint16_t id) : id(id) { Trace::begin(id); }
+		~TraceScope() { Trace::end(id); }
+	private:
+		uint16_t id;
+	};
+}
+
+/********************************************************/
+/* Device I/O accounting                                */
+/********************************************************/
+namespace adlib {
+	enum class IoCall : uint8_t {
+		DistanceGet,
+		IsInstalled,
+		GetDigital,
+		GetAnalog,
+		MotorTelemetry,		// all the fields read by Motor::sample()
+		OpticalGet,
+		AdiRead,
+		AdiWrite,
+		Count
+	};
+
+	// Counts device accesses made by adlib, with the time spent, per device, call type and task.
+	// A read is a duplicate when the same device was read again within one sensor update period.
+	class IoStats {
+	public:
+		// Device index: smart ports 1-21, ADI ports A-H after them, then the controller
+		static constexpr int ADI_PORT = 21;
+		static constexpr int CONTROLLER_PORT = 30;
+		static constexpr int MAX_PORTS = 32;
+		static constexpr int MAX_TASKS = 8;
+		static constexpr int MAX_CHANNELS = 16;	// button, axis or field within one device
+
+		// Device index of an ADI port given as 1-8, 'a'-'h' or 'A'-'H'
+		static int adi_port(uint8_t port) {
+			if(port >= 'a' && port <= 'h')
+				port -= 'a' - 1;
+			else if(port >= 'A' && port <= 'H')
+				port -= 'A' - 1;
+			return ADI_PORT + port;
+		}
+
+		static void enable(bool on);
+		static void reset();
+		static std::string report();
+		static bool dump(const char* filename = "/usd/io_stats.txt");
+
+		// Run one device access, timed and counted when enabled. Reads of different channels
+		// of a device (buttons, axes, optical fields) are not duplicates of each other.
+		template <typename F>
+		static auto call(int port, IoCall type, F fn, int channel = 0) -> decltype(fn()) {
+			if(!enabled.test())
+				return fn();
+			uint32_t t0 = pros::micros();
+			auto r = fn();
+			record(port, type, channel, pros::micros() - t0);
+			return r;
+		}
+
+	private:
+		static void record(int port, IoCall type, int channel, uint32_t us);
+		static uint32_t period_ms(IoCall type);
+
+		struct Counter {
+			std::atomic<uint32_t> calls{0};
+			std::atomic<uint32_t> time_us{0};
+			std::atomic<uint32_t> duplicates{0};
+			std::atomic<uint32_t> seen{0};		// bit per channel read since the reset
+			std::atomic<uint32_t> last_ms[MAX_CHANNELS] = {};
+		};
+		struct TaskCounter {
+			std::atomic<pros::task_t> task{nullptr};
+			char name[32] = "";		// copied on claim, the task may be gone by the report
+			std::atomic<uint32_t> calls{0};
+			std::atomic<uint32_t> time_us{0};
+		};
+		static TaskCounter* task_counter();
+
+		static Counter counters[MAX_PORTS][(int)IoCall::Count];
+		static TaskCounter tasks[MAX_TASKS];
+		static TaskCounter other_tasks;		// calls from tasks past MAX_TASKS
+		static std::atomic<uint32_t> start_ms;
+		static AtomicFlag enabled;
+	};
+}
 
 namespace adlib {
 	enum {
@@ -27,6 +222,13 @@ namespace adlib {
 		BUTTON_R2		= pros::E_CONTROLLER_DIGITAL_R2
 	};
 
+	enum {
+		ANALOG_LEFT_X	= pros::E_CONTROLLER_ANALOG_LEFT_X,
+		ANALOG_LEFT_Y	= pros::E_CONTROLLER_ANALOG_LEFT_Y,
+		ANALOG_RIGHT_X	= pros::E_CONTROLLER_ANALOG_RIGHT_X,
+		ANALOG_RIGHT_Y	= pros::E_CONTROLLER_ANALOG_RIGHT_Y
+	};
+
 	class Controller : public pros::Controller {
 	public:
 		Controller(pros::controller_id_e_t id);
@@ -35,10 +237,17 @@ namespace adlib {
 		bool is_button_pressed(int button);
 		void button_pressed(int button, std::function<void()> callback);
 		void button_released(int button, std::function<void()> callback);
+		void chord_pressed(int button1, int button2, std::function<void()> callback);
 		void button_process();
 
+		int get_axis(int axis);
+		void axis_changed(int axis, std::function<void(int)> callback, int threshold = 3, int keepalive_ms = 500);
+		void axis_process();
+
 		void clear(int row = -1);
 		void print(int row, int col, const char* fmt, ...);
+		template <typename... Args>
+		void print_deferred(int row, int col, const char* fmt, Args... args);
 		void rumble(const char* rumble_pattern);
 		void print_process();
 
@@ -70,22 +279,143 @@ namespace adlib {
 			{ BUTTON_R2,	false, nullptr, nullptr }
 		};
 		const size_t num_of_buttons = buttons.size();
+		bool button_state(int button);
+
+		struct ChordStruct {
+			int button1, button2;
+			bool last_state = false;
+			std::function<void()> on_press = nullptr;
+		};
+		std::vector<ChordStruct> chords;
+
+		struct AxisStruct {
+			int id;
+			std::atomic<int> value{0};		// last sampled value, -127 ~ 127
+			int published = 0;				// value passed to the last callback
+			uint32_t published_time = 0;
+			int threshold = 3;				// change needed to publish
+			int keepalive_ms = 500;			// publish unchanged values this often, 0 never
+			std::function<void(int)> on_change = nullptr;
+		};
+		AxisStruct axes[4];
+		AxisStruct* find_axis(int axis);
 
 		static constexpr int MAX_NUM_OF_MSG = 8;
 		static constexpr int MAX_MSG_LEN = 36;
+		static constexpr int MAX_DEFERRED_ARGS = 4;
 		enum {	//first byte in the msg
 			MSG_CLEAR = 1,
 			MSG_RUMBLE = 2,
-			MSG_TEXT = 3
+			MSG_TEXT = 3,
+			MSG_DEFERRED = 4
 		};
 
-		char buf[MAX_NUM_OF_MSG][MAX_MSG_LEN];
-		int rd_ptr = 0;
-		int wr_ptr = 0;
-		bool is_buf_full();
-		bool is_buf_empty();
-		void update_wr_ptr();
-		void update_rd_ptr();
+		struct Arg {
+			enum : uint8_t { INT, DOUBLE, STRING } type;
+			union {
+				int32_t i;
+				double d;
+				const char* s;
+			};
+		};
+
+		struct Message {
+			char data[MAX_MSG_LEN];		// MSG_DEFERRED: the slot in data[1]
+		};
+		// Any task may print, only the controller task sends
+		MpscRing<Message, MAX_NUM_OF_MSG> msgs;
+
+		// Latest deferred print for one position. A newer print to the same row and col
+		// replaces the values while the message is still the last one queued, so only the
+		// last one is formatted and sent.
+		struct Deferred {
+			int row = -1, col = -1;
+			const char* fmt = nullptr;
+			int num_args = 0;
+			Arg args[MAX_DEFERRED_ARGS];
+			bool queued = false;
+			uint32_t seq = 0;		// msg_seq when the slot was queued
+		};
+		Deferred deferred[MAX_NUM_OF_MSG];
+		pros::Mutex deferred_mutex;
+		std::atomic<uint32_t> msg_seq{0};	// messages queued so far
+		void queue_deferred(const Deferred& d);
+
+		template <typename T>
+		static void pack_arg(Deferred& m, T value) {
+			Arg& a = m.args[m.num_args++];
+			if constexpr (std::is_floating_point<T>::value) {
+				a.type = Arg::DOUBLE;
+				a.d = value;
+			}
+			else if constexpr (std::is_pointer<T>::value) {
+				a.type = Arg::STRING;
+				a.s = value;
+			}
+			else {
+				a.type = Arg::INT;
+				a.i = (int32_t)value;
+			}
+		}
+		static void format_deferred(const Deferred& m, char* out, int len);
+	};
+
+	// Like print(), but only fmt and the raw values are queued, the text is formatted
+	// on the controller task when the message is sent. Prints to the same row and col
+	// that arrive before it is sent replace it, so values that are superseded are never
+	// formatted. fmt and string arguments must stay valid (literals).
+	template <typename... Args>
+	void Controller::print_deferred(int row, int col, const char* fmt, Args... args) {
+		static_assert(sizeof...(Args) <= MAX_DEFERRED_ARGS, "too many arguments");
+		Deferred d;
+		d.row = row;
+		d.col = col;
+		d.fmt = fmt;
+		(pack_arg(d, args), ...);
+		queue_deferred(d);
+	}
+}
+
+namespace adlib {
+	enum class MatchPhase {
+		Disabled,
+		Autonomous,
+		Driver
+	};
+
+	// Timed events relative to the end of the autonomous or driver period
+	class MatchClock {
+	public:
+		MatchClock(Controller& controller, int auton_sec = 15, int driver_sec = 105);
+		void at(MatchPhase phase, int sec_remaining, std::function<void()> callback);
+		void rumble_at(int sec_remaining, const char* rumble_pattern);
+		void countdown(int from_sec, int row, int col = 0);
+		void start_task();
+		MatchPhase phase();
+		int remaining_ms();
+
+	private:
+		void start_phase(MatchPhase p, uint32_t now);
+		int phase_length_ms(MatchPhase p);
+
+		Controller& controller;
+		pros::Task* clock_task = nullptr;
+		int auton_ms;
+		int driver_ms;
+		static constexpr int POLL_MS = 10;	// competition mode check interval
+
+		struct Event {
+			MatchPhase phase;
+			int remaining_ms;
+			std::function<void()> callback;
+		};
+		// Register events before start_task(), they are run on the clock task
+		std::vector<Event> events;
+		std::vector<int> queue;		// events of the current phase ordered by due time
+		int next = 0;				// next entry in queue
+
+		std::atomic<int> current_phase{(int)MatchPhase::Disabled};
+		std::atomic<uint32_t> phase_start{0};
 	};
 }
 
@@ -113,6 +443,57 @@ namespace adlib {
 		CENTER	= 65535
 	};
 
+	// Many assets in one SD file, opened once and looked up by name in O(1).
+	// Layout, little endian:
+	//   header   "ADPK", version, number of index slots (power of 2), number of assets
+	//   index    one slot per 16 bytes: FNV-1a hash of the name (0 = empty), offset, size, 0
+	//            open addressing with linear probing from hash & (slots - 1)
+	//   blobs    each asset starts on a 512 byte boundary
+	class AssetPack {
+	public:
+		~AssetPack();
+		bool open(const char* filename);
+		void close();
+		bool is_open();
+		bool contains(const char* name);
+		bool load(const char* name, std::vector<uint8_t>& data);
+		static bool build(const char* filename, const std::vector<std::string>& files);
+		static uint32_t hash(const char* name);
+
+		static constexpr uint32_t VERSION = 1;
+		static constexpr int ALIGN = 512;
+
+	private:
+		struct Slot {
+			uint32_t hash;
+			uint32_t offset;
+			uint32_t size;
+			uint32_t reserved;
+		};
+		const Slot* find(const char* name);
+
+		FILE* file = nullptr;
+		std::vector<Slot> index;
+		pros::Mutex mutex;		// the file position is shared by all readers
+	};
+
+	// Palette image in the adlib format: width and height (big endian 16 bit),
+	// 256 RGBA palette entries, then one palette index per pixel
+	struct Image {
+		int w = 0;
+		int h = 0;
+		uint32_t palette[256];		// 0xRRGGBB
+		uint8_t alpha[256];
+		bool transparent = false;	// some pixels are fully transparent
+		std::vector<uint8_t> storage;		// the whole file when loaded into RAM
+		const uint8_t* external = nullptr;	// or a blob that outlives the image
+		size_t external_size = 0;
+		const uint8_t* pixels() const { return (external != nullptr ? external : storage.data()) + HEADER_SIZE; }
+		void blend_palette(uint32_t bgcolor, uint32_t* out) const;
+
+		static constexpr int HEADER_SIZE = 4 + 256 * 4;
+	};
+
 	class Brain {
 	public:
 		Brain();
@@ -123,6 +504,13 @@ namespace adlib {
 		void print(double row, double col, uint32_t color, const char* fmt, ...);
 		void print(pros::text_format_e_t font, double row, double col, uint32_t color, const char* fmt, ...);
 		void draw_image(const char* filename, int x = 0, int y = 0, int32_t bgcolor = 0xffffffff);
+		void draw_image(const Image& image, int x = 0, int y = 0, int32_t bgcolor = 0xffffffff);
+		void draw_image(const uint8_t* data, size_t size, int x = 0, int y = 0, int32_t bgcolor = 0xffffffff);
+		bool load_image(const char* filename, Image& image);
+		bool load_image(const uint8_t* data, size_t size, Image& image);
+		bool cache_image(const char* filename);
+		void clear_image_cache();
+		void use_assets(AssetPack* pack);
 		void draw_line(int x1, int y1, int x2, int y2, uint32_t color = 0xffffffff);
 		void pressed(std::function<bool()> callback);
 		void released(std::function<bool()> callback);
@@ -143,17 +531,38 @@ namespace adlib {
 			std::function<void()> on_press = nullptr;
 			std::function<void()> on_release = nullptr;
 			bool is_touched();
+			void prerender(uint32_t pressed_color, uint32_t pressed_bgcolor);
+			void show_pressed(bool pressed);
 
 		private:
+			void layout();
+			void draw_text(uint32_t c);
+			void render(std::vector<uint32_t>& raster, uint32_t bg);
+
 			int x1, y1, x2, y2, radius;
 			bool big;
 			std::string text;
 			uint32_t color;
 			uint32_t bgcolor;
+
+			struct TextLine {
+				int x, y;
+				std::string text;
+			};
+			std::vector<TextLine> lines;	// text position, computed when the text changes
+
+			// Shape rasters for instant touch feedback, see prerender()
+			bool prerendered = false;
+			uint32_t pressed_color;
+			uint32_t pressed_bgcolor;
+			uint32_t outside_color;			// screen color around the rounded corners
+			std::vector<uint32_t> normal_raster;
+			std::vector<uint32_t> pressed_raster;
 		};
 
 	private:
 		bool check_device(int port, Device type);
+		bool check_device_installed(int port, Device type);
 
 		static constexpr int SCREEN_W = 480;
 		static constexpr int SCREEN_H = 239;
@@ -164,15 +573,161 @@ namespace adlib {
 		std::function<bool()> on_press = nullptr;
 		std::function<bool()> on_release = nullptr;
 		std::vector<Button*> buttons;
+		Button* pressed_button = nullptr;		// shown pressed until the touch is released
+
+		bool parse_image(Image& image);
+		std::map<std::string, Image> images;	// decoded images by file name
+		AssetPack* assets = nullptr;			// looked up before the loose files
+		pros::Mutex image_mutex;
+		static constexpr int BLIT_ROWS = 8;		// rows per copy_area when drawing an image
 	};
 }
 
 namespace adlib {
+	template <typename T>
+	struct Sample {
+		T value;
+		uint32_t time;		// pros::millis() when the device acquired the value
+		uint32_t period;	// msec between device updates
+	};
+
+	class LatencyCompensator {
+	public:
+		LatencyCompensator(double latency_ms = 0, double smoothing = 0.5);
+		void update(const Sample<double>& s);
+		double velocity();
+		double predict(uint32_t now);
+		double predict();
+	private:
+		double latency_ms;		// extra delay between the read and the actuation
+		double smoothing;		// 0..1, weight of the newest velocity estimate
+		Sample<double> last = { 0, 0, 0 };
+		bool has_last = false;
+		double vel = 0;			// units per second
+	};
+
 	class Distance : public pros::Distance {
 	public:
 		Distance(uint8_t port);
 		double get_inches();
+		Sample<double> read_inches();
 		double distance_to_wall();
+
+		void start_task();
+		Sample<double> latest();
+		void below(double inches, std::function<void()> callback, double hysteresis = 0.5, int debounce_ms = 0);
+		void above(double inches, std::function<void()> callback, double hysteresis = 0.5, int debounce_ms = 0);
+		void crossing(double inches, std::function<void()> callback, double hysteresis = 0.5, int debounce_ms = 0);
+		bool wait_below(double inches, uint32_t timeout = TIMEOUT_MAX);
+		bool wait_above(double inches, uint32_t timeout = TIMEOUT_MAX);
+		void sampled(std::function<void(const Sample<double>&)> callback);
+
+		static constexpr int UPDATE_MS = 33;	// distance sensor refreshes about every 33 msec
+		static constexpr int SAMPLER_MS = 5;	// the sampler polls faster to catch each update early
+
+	private:
+		Sample<double> acquire();
+		void sampler_process();
+		bool wait_until(bool below, double inches, uint32_t timeout);
+
+		double last_inches = -1;
+		uint32_t last_time = 0;
+
+		pros::Task* sampler_task = nullptr;
+		SeqLock<Sample<double>> sample;
+		uint32_t sample_time = 0;
+
+		enum TriggerType {
+			TRIGGER_BELOW,
+			TRIGGER_ABOVE,
+			TRIGGER_CROSSING
+		};
+
+		struct Trigger {
+			TriggerType type;
+			double threshold;
+			double hysteresis;
+			int debounce_ms;
+			std::function<void()> callback;
+			int side = 0;				// 1: condition met, -1: released, 0: unknown
+			bool pending = false;		// condition met but still debouncing
+			uint32_t pending_since = 0;
+		};
+		// Triggers are evaluated on the sampler task. New ones go to added_triggers and are
+		// moved over by the sampler between readings, so they can be added at any time.
+		std::vector<Trigger> triggers;			// owned by the sampler task
+		std::vector<Trigger> added_triggers;
+		pros::Mutex added_mutex;
+		void take_added();
+		void add_trigger(TriggerType type, double inches, std::function<void()> callback, double hysteresis, int debounce_ms);
+		void evaluate_trigger(Trigger& t, const Sample<double>& s);
+		std::vector<std::function<void(const Sample<double>&)>> on_sample;			// owned by the sampler task
+		std::vector<std::function<void(const Sample<double>&)>> added_on_sample;	// moved over like added_triggers
+
+		// Tasks blocked in wait_below() or wait_above()
+		struct Waiter {
+			std::atomic<pros::task_t> task{nullptr};
+			std::atomic<bool> armed{false};
+			double threshold = 0;
+			bool below = true;
+		};
+		static constexpr int MAX_WAITERS = 4;
+		Waiter waiters[MAX_WAITERS];
+	};
+
+	enum class ObjectColor {
+		None,
+		Red,
+		Blue
+	};
+
+	struct ObjectStatus {
+		bool present = false;
+		ObjectColor color = ObjectColor::None;
+		uint32_t entry_time = 0;	// pros::millis() of the first reading with the object
+		uint32_t exit_time = 0;		// pros::millis() of the first reading without it
+	};
+
+	// Detect an object with a Distance sensor and classify its color with an Optical sensor,
+	// both are read on the distance sampler task so the two readings are time-aligned
+	class ObjectDetector {
+	public:
+		ObjectDetector(Distance& distance, pros::Optical& optical, double present_inches, double hysteresis = 0.5);
+		void set_red_hue(double min, double max);
+		void set_blue_hue(double min, double max);
+		void set_min_saturation(double s);
+		void entered(std::function<void(ObjectColor)> callback);
+		void exited(std::function<void(ObjectColor)> callback);
+		void start();
+		ObjectStatus status();
+
+	private:
+		void process(const Sample<double>& s);
+		ObjectColor read_color();
+
+		Distance& distance;
+		pros::Optical& optical;
+		double present_inches;
+		double hysteresis;
+		double red_min = 340, red_max = 20;		// hue range wraps around 0
+		double blue_min = 180, blue_max = 260;
+		double min_saturation = 0.3;
+		std::function<void(ObjectColor)> on_enter = nullptr;
+		std::function<void(ObjectColor)> on_exit = nullptr;
+		bool started = false;
+
+		enum State {
+			EMPTY,
+			ENTERING,	// object is close, collecting color votes
+			PRESENT,
+			LEAVING		// object moved away, waiting for one more reading to confirm
+		};
+		State state = EMPTY;
+		static constexpr int COLOR_VOTES = 2;	// readings used to decide the color
+		int red_votes = 0;
+		int blue_votes = 0;
+		ObjectStatus current;
+		SeqLock<ObjectStatus> published;
 	};
 
 	class ADIDigitalOut : public pros::ADIDigitalOut {
@@ -183,7 +738,682 @@ namespace adlib {
 		void release();
 		void toggle();
 	private:
+		uint8_t port;
 		bool current_value = false;
 		bool is_reversed = false;
 	};
+
+	// Base of the ADI inputs, all of them are sampled by one shared background task
+	class ADIInput {
+	public:
+		static void start_task();
+		void set_period(int ms);
+
+		static constexpr int TICK_MS = 5;	// resolution of the sample periods
+		virtual ~ADIInput();
+
+	protected:
+		ADIInput(uint8_t port, int period_ms);
+		virtual void sample(uint32_t now) = 0;
+		void start_sampling();
+		void stop_sampling();
+		uint8_t port;
+	private:
+		static std::vector<ADIInput*>& inputs();
+		static pros::Mutex& inputs_mutex();
+		static pros::Task* adi_task;
+		int period_ms;
+		uint32_t last_sample = 0;
+	};
+
+	class ADIDigitalIn : public pros::ADIDigitalIn, public ADIInput {
+	public:
+		ADIDigitalIn(uint8_t port, int debounce_ms = 10, int period_ms = 5);
+		~ADIDigitalIn();
+		bool is_pressed();
+		bool get_new_press();
+		void pressed(std::function<void()> callback);
+		void released(std::function<void()> callback);
+	private:
+		void sample(uint32_t now) override;
+		int debounce_ms;
+		bool raw_state = false;
+		uint32_t raw_since = 0;
+		std::atomic<bool> state{false};
+		std::atomic<bool> new_press{false};
+		std::function<void()> on_press = nullptr;
+		std::function<void()> on_release = nullptr;
+	};
+
+	class ADIAnalogIn : public pros::ADIAnalogIn, public ADIInput {
+	public:
+		ADIAnalogIn(uint8_t port, int oversample = 4, double smoothing = 0.5, int period_ms = 10);
+		~ADIAnalogIn();
+		double calibrate();
+		void set_scale(double units_per_count);
+		double get_value();
+		double get_value_calibrated();
+	private:
+		void sample(uint32_t now) override;
+
+		// Box filter over the last samples, followed by an exponential filter
+		static constexpr int MAX_OVERSAMPLE = 16;
+		int oversample;
+		int32_t window[MAX_OVERSAMPLE] = {};
+		int32_t window_sum = 0;
+		int win_ptr = 0;
+		int win_cnt = 0;
+		double smoothing;		// 0..1, weight of the newest average
+		double filtered = 0;
+
+		std::atomic<double> value{0};
+		double zero = 0;
+		double scale = 1;
+	};
+}
+
+namespace adlib {
+	struct MotorTelemetry {
+		uint32_t time = 0;			// pros::millis() when the sample was taken
+		double current = 0;			// mA
+		double velocity = 0;		// rpm
+		double voltage = 0;			// mV
+		double temperature = 0;		// degree C
+	};
+
+	class Motor : public pros::Motor {
+	public:
+		Motor(int8_t port);
+		MotorTelemetry sample();
+		MotorTelemetry telemetry();
+
+		static constexpr int UPDATE_MS = 10;	// motor telemetry is refreshed every 10 msec
+	private:
+		SeqLock<MotorTelemetry> last;
+		pros::Mutex sample_mutex;		// sample() may run on several tasks, the SeqLock takes one writer
+	};
+
+	class JamDetector {
+	public:
+		JamDetector(Motor& motor, double current_threshold, double velocity_threshold, int stall_ms = 200);
+		void set_hysteresis(double current_release, double velocity_release);
+		void jammed(std::function<void()> callback);
+		void cleared(std::function<void()> callback);
+		bool is_jammed();
+		void update(const MotorTelemetry& t);
+		void start_task();
+
+	private:
+		Motor& motor;
+		pros::Task* detector_task = nullptr;
+		std::function<void()> on_jam = nullptr;
+		std::function<void()> on_clear = nullptr;
+
+		double current_threshold;		// mA, stall when the average current is above
+		double velocity_threshold;		// rpm, stall when the average speed is below
+		double current_release;			// mA, jam clears when the average current drops below
+		double velocity_release;		// rpm, jam clears when the average speed rises above
+		int stall_ms;
+
+		// Rolling window, the sums are updated in O(1) per sample
+		static constexpr int WINDOW = 5;
+		double current_buf[WINDOW] = {};
+		double velocity_buf[WINDOW] = {};
+		double current_sum = 0;
+		double velocity_sum = 0;
+		int win_ptr = 0;
+		int win_cnt = 0;
+
+		bool stalling = false;
+		uint32_t stall_start = 0;
+		bool jam = false;
+	};
+}
+
+namespace adlib {
+	class Config;
+
+	// Feedforward for a motor group, volts = ks * sign(v) + kv * v + ka * a, v in rpm and a in rpm/s
+	struct Feedforward {
+		double ks = 0;
+		double kv = 0;
+		double ka = 0;
+		double r2 = 0;		// fit quality, 1 is a perfect fit
+		int samples = 0;	// samples used by the fit
+	};
+
+	// Drive a motor group with voltage ramps and steps and fit the feedforward constants.
+	// The robot needs clear space ahead and behind, each test runs forward then back.
+	class Characterizer {
+	public:
+		Characterizer(const std::vector<Motor*>& motors, size_t capacity = 4000);
+		void set_quasistatic(double ramp_mv_per_s, int duration_ms);
+		void set_dynamic(double step_mv, int duration_ms);
+		bool run();
+		void cancel();
+		Feedforward fit();
+		bool dump(const char* filename = "/usd/characterize.csv");
+		void store(Config& config, const char* prefix = "ff");
+
+	private:
+		struct Sample {
+			uint32_t time;
+			float voltage;		// V, average over the group
+			float velocity;		// rpm
+			float accel;		// rpm/s
+		};
+		bool test(std::function<double(uint32_t)> voltage_at, int duration_ms);
+		void apply(double mv);
+
+		std::vector<Motor*> motors;
+		size_t capacity;
+		std::vector<Sample> samples;
+		AtomicFlag cancelled;
+		Feedforward result;
+
+		double ramp_mv_per_s = 1000;
+		int ramp_ms = 6000;
+		double step_mv = 7000;
+		int step_ms = 2000;
+		static constexpr int SETTLE_MS = 1000;	// coast to a stop between tests
+	};
+}
+
+namespace adlib {
+	// Share a current budget across motor groups by priority, the budget shrinks with
+	// the predicted battery sag and hot motors are derated before they shut down
+	class PowerManager {
+	public:
+		PowerManager(double budget_ma = 20000, double min_voltage_mv = 10500);
+		void add(const std::vector<Motor*>& motors, int priority, int min_ma = 500, int max_ma = 2500);
+		void set_thermal(double derate_c, double cutoff_c);
+		void update();
+		void start_task();
+
+		double battery_voltage();
+		double resistance();
+		double predicted_sag(double current_ma);
+		double budget();
+		int limit_events();
+
+		static constexpr int UPDATE_MS = 20;
+		static constexpr int HYSTERESIS_MA = 100;	// smaller changes are not sent to the motor
+		static constexpr int HEADROOM_MA = 500;		// room to speed up above the measured draw
+
+	private:
+		struct Group {
+			std::vector<Motor*> motors;
+			int priority;
+			int min_ma, max_ma;
+			std::vector<int> applied;	// last limit sent to each motor
+			std::vector<int> cap;		// thermal cap for this tick
+			std::vector<int> need;		// measured draw plus headroom, within min_ma and cap
+			std::vector<int> grant;		// min_ma plus the demand share for this tick
+		};
+		std::vector<Group> groups;
+		pros::Task* power_task = nullptr;
+
+		double max_budget;
+		double min_voltage;
+		double derate_c = 45;			// start reducing the limit
+		double cutoff_c = 55;			// down to min_ma, the motor halves its own power at 55
+
+		std::atomic<double> voltage{0};		// filtered mV
+		std::atomic<double> current{0};		// filtered mA
+		std::atomic<double> ohms{0.05};		// estimated internal resistance, pack plus wiring
+		std::atomic<double> allowed{0};		// budget for the last tick, mA
+		double last_v = 0, last_i = 0;
+		std::atomic<int> events{0};
+	};
+}
+
+namespace adlib {
+	enum class RecordType : uint8_t {
+		Button,		// id: button, value: 1 pressed / 0 released
+		Axis,		// id: analog channel, value: -127 ~ 127
+		Distance,	// id: port, value: inches
+		Motor,		// id: port, value: current in mA
+		Digital,	// id: ADI port, value: output or input state
+		Marker,		// id and value set by the user
+		CurrentLimit	// id: motor port, value: current limit in mA
+	};
+
+	// Pre-trigger flight recorder, keeps the last samples in RAM and writes them to SD only on a trigger
+	class BlackBox {
+	public:
+		BlackBox(size_t capacity = 4096);
+		static BlackBox* instance;
+
+		void record(RecordType type, uint16_t id, float value);
+		void trigger(const char* reason);
+		void rearm();
+		bool is_frozen();
+
+		void watchdog(uint32_t timeout_ms);
+		void kick();
+		void monitor(const std::vector<DeviceInfo>& devices);
+		void chord(Controller& controller, int button1, int button2);
+		void start_task();
+
+		static constexpr int MONITOR_MS = 100;	// watchdog and device check interval
+
+	private:
+		void dump();
+
+		struct Record {
+			uint32_t time;
+			uint16_t id;
+			RecordType type;
+			float value;
+		};
+		std::vector<Record> records;
+		std::atomic<uint32_t> head{0};		// total number of records written
+		AtomicFlag triggered;		// claimed by the first trigger, before reason is written
+		AtomicFlag frozen;
+		AtomicFlag dumped;
+		char reason[32] = "";
+		int dump_cnt = 0;			// next file index to try
+
+		pros::Task* box_task = nullptr;
+		std::atomic<pros::task_t> box_handle{nullptr};
+		uint32_t watchdog_ms = 0;
+		std::atomic<uint32_t> last_kick{0};
+		std::vector<DeviceInfo> devices;
+		bool devices_ok = true;
+	};
+}
+
+namespace adlib {
+	// Time PROS and adlib calls on the robot and report the cost per call
+	class Benchmark {
+	public:
+		Benchmark(Brain& brain, Controller& controller);
+		void add(const char* name, int iterations, std::function<void()> fn,
+				 std::function<void()> setup = nullptr, std::function<void()> teardown = nullptr);
+		void add_defaults(Distance* distance = nullptr, const char* image = nullptr,
+						  const std::vector<DeviceInfo>& devices = {});
+		void attach(Brain::Button& button);
+		void run();
+
+	private:
+		void write_report();
+
+		Brain& brain;
+		Controller& controller;
+		pros::Task* bench_task = nullptr;
+		AtomicFlag running;
+		FILE* scratch = nullptr;		// open during the fread case
+
+		struct Case {
+			std::string name;
+			int iterations;
+			std::function<void()> fn;
+			std::function<void()> setup;
+			std::function<void()> teardown;
+			double mean_us = 0;
+			uint32_t max_us = 0;
+		};
+		std::vector<Case> cases;
+	};
+}
+
+namespace adlib {
+	// Time the named steps of an autonomous, aggregate them across runs on SD and find the
+	// critical path. Steps may overlap when they run in other tasks; a step is taken to wait
+	// for the step that ended last before it started.
+	class StepTimer {
+	public:
+		StepTimer(const char* filename = "/usd/steps.csv");
+		void begin_run();
+		int begin(const char* name);
+		void end(int step);
+		void end_run();
+		void show(Brain& brain);
+
+		static constexpr int MAX_STEPS = 64;	// per run, later steps are not timed
+		static constexpr int GATE_MS = 5;		// an end this close before a start is its gate
+
+	private:
+		struct Step {
+			const char* name;		// not copied, pass a string literal
+			uint32_t start;
+			uint32_t end;			// 0 while running
+		};
+		struct Stats {
+			std::string name;
+			int n = 0;
+			double mean = 0;		// duration in ms, Welford running mean and M2
+			double m2 = 0;
+			double slack = 0;		// mean slack in ms
+			bool critical = false;	// on the critical path in the last run
+		};
+		void load();
+		void save();
+		Stats& find(const char* name);
+
+		std::string filename;
+		Step steps[MAX_STEPS];
+		std::atomic<int> step_cnt{0};
+		uint32_t run_start = 0;
+		uint32_t run_ms = 0;
+		std::vector<Stats> stats;
+		bool loaded = false;
+	};
+
+	class StepScope {
+	public:
+		StepScope(StepTimer& timer, const char* name) : timer(timer), step(timer.begin(name)) {}
+		~StepScope() { timer.end(step); }
+	private:
+		StepTimer& timer;
+		int step;
+	};
+}
+
+namespace adlib {
+	// Key/value settings kept in a text file on SD, one "key=value" per line
+	class Config {
+	public:
+		Config(const char* filename = "/usd/config.txt");
+		bool load();
+		bool load(AssetPack& pack);
+		bool save();
+		bool is_loaded();
+		double get(const std::string& key, double default_value = 0);
+		std::string get_string(const std::string& key, const std::string& default_value = "");
+		void set(const std::string& key, double value);
+		void set_string(const std::string& key, const std::string& value);
+
+	private:
+		void parse(const char* text, size_t len);
+
+		std::string filename;
+		std::map<std::string, std::string> entries;
+		std::atomic<bool> loaded{false};
+		pros::Mutex mutex;
+	};
+
+	// Run preparation jobs while the robot is disabled before the match
+	class Prewarm {
+	public:
+		// A job returns true when done, it should return early when cancelled() becomes true
+		typedef std::function<bool(const std::function<bool()>& cancelled)> Job;
+
+		void add(const char* name, Job job);
+		void add_image(const char* filename);
+		void add_sampler(Distance& distance);
+		void add_config(Config& config);
+		void start_task();
+		void run();
+		bool is_ready();
+		std::string report();
+
+	private:
+		bool run_job(int i, const std::function<bool()>& cancelled);
+
+		enum {
+			JOB_PENDING,
+			JOB_DONE,
+			JOB_FAILED
+		};
+
+		struct JobStruct {
+			std::string name;
+			Job job;
+			std::atomic<int> state{JOB_PENDING};
+			uint32_t duration = 0;		// msec spent in the last run
+		};
+		std::vector<JobStruct*> jobs;
+		pros::Task* prewarm_task = nullptr;
+		static constexpr int POLL_MS = 20;
+	};
+}
+
+namespace adlib {
+	struct Pose {
+		double x = 0;		// inches from the left edge of the field
+		double y = 0;		// inches from the bottom edge of the field
+		double theta = 0;	// degrees, 0 faces up, clockwise like the IMU heading
+	};
+
+	// Field diagram with the robot on top, only the robot footprint is redrawn on a pose update
+	class FieldMap {
+	public:
+		FieldMap(Brain& brain, const char* background, int x, int y, double field_inches = 144);
+		bool initialize();
+		void set_robot(double size_inches, uint32_t color, uint32_t heading_color = 0xffffff);
+		void update(const Pose& pose);
+
+	private:
+		struct Rect {
+			int x1, y1, x2, y2;		// inclusive, in map pixels
+		};
+		void render(const Rect& r, const double* px, const double* py, double hx, double hy, double fx, double fy);
+
+		Brain& brain;
+		std::string background_file;
+		int x0, y0;					// top left corner on the screen
+		int w = 0, h = 0;
+		double field_inches;
+		double scale = 1;			// pixels per inch
+		std::vector<uint32_t> background;	// decoded field, w * h pixels
+
+		double robot_inches = 18;
+		uint32_t robot_color = 0x808080;
+		uint32_t heading_color = 0xffffff;
+
+		bool has_old = false;
+		Rect old_rect;				// last footprint bounding box
+		std::vector<uint32_t> scratch;
+	};
+}
+
+namespace adlib {
+	// One row of a recorded path, velocity is the driven speed at that point
+	struct PathPoint {
+		uint32_t time;		// ms from the start of the recording
+		float x, y;			// inches
+		float theta;		// degrees
+		float velocity;		// inches per second
+	};
+
+	// Record the odometry pose during driver control and simplify it into a path table
+	// that a follower can play back in autonomous
+	class PathRecorder {
+	public:
+		PathRecorder(std::function<Pose()> odometry, int period_ms = 20, int max_seconds = 60);
+		void chord(Controller& controller, int button1, int button2);
+		bool start();
+		void stop();
+		bool is_recording();
+		bool is_busy();
+		void set_tolerance(double inches, double degrees = 5);
+		void start_task();
+
+		std::vector<PathPoint> path();
+		static bool load(const char* filename, std::vector<PathPoint>& path);
+
+	private:
+		void simplify();
+		void save();
+
+		std::function<Pose()> odometry;
+		int period_ms;
+		size_t capacity;
+		double tolerance = 0.5;			// inches off the simplified path
+		double heading_tolerance = 5;	// degrees off the simplified path
+
+		std::vector<PathPoint> raw;		// owned by the sample task until busy is set
+		std::vector<PathPoint> table;
+		pros::Mutex table_mutex;
+		AtomicFlag want;				// recording requested
+		AtomicFlag busy;				// raw samples waiting for the simplify task
+		int path_cnt = 0;				// next file index to try
+
+		pros::Task* sample_task = nullptr;
+		pros::Task* simplify_task = nullptr;
+	};
+}
+
+namespace adlib {
+	// Scrolling log region on the Brain screen, any task can log without waiting for the screen
+	class Console {
+	public:
+		Console(int x, int y, int w, int rows, uint32_t color = 0xffffff, uint32_t bgcolor = 0x000000);
+		void log(const char* fmt, ...);
+		void start_task();
+		void redraw();
+		int dropped();
+
+		static constexpr int LINE_H = 20;		// medium font line height
+		static constexpr int FRAME_MS = 50;		// screen update interval
+		static constexpr int MAX_LINE_LEN = 48;
+
+	private:
+		void render();
+		void draw_line(int row, const char* text);
+
+		struct Line {
+			char text[MAX_LINE_LEN];
+		};
+		MpscRing<Line, 32> queue;			// new lines waiting for the console task
+		std::atomic<int> num_dropped{0};
+
+		int x, y, w, rows;
+		uint32_t color, bgcolor;
+		std::vector<Line> history;			// visible lines, oldest at history_ptr
+		int history_ptr = 0;
+		int num_of_lines = 0;				// lines on the screen so far, up to rows
+		pros::Task* console_task = nullptr;
+	};
+}
+
+namespace adlib {
+	// Table-driven state machine, the transitions are compiled into a dense [state][event] table.
+	// Events are posted from any task (controller callbacks, sensor triggers) and dispatched
+	// by process() on the owner task, a dispatch is a table lookup without allocation.
+	template <typename Context, int NUM_STATES, int NUM_EVENTS>
+	class StateMachine {
+	public:
+		typedef void (*Action)(Context& context);
+
+		struct Transition {
+			int from;
+			int event;
+			int to;
+			Action action;	// may be nullptr
+		};
+
+		struct Table {
+			uint8_t next[NUM_STATES][NUM_EVENTS] = {};
+			Action action[NUM_STATES][NUM_EVENTS] = {};
+		};
+
+		struct TraceEntry {
+			uint32_t time;
+			uint8_t from;
+			uint8_t event;
+			uint8_t to;
+		};
+
+		static constexpr uint8_t NONE = 0xff;	// no transition for this state and event
+		static constexpr int TRACE_LEN = 16;
+
+		// Build the table at compile time: static constexpr auto table = SM::build(transitions);
+		template <size_t N>
+		static constexpr Table build(const Transition (&list)[N]) {
+			Table t;
+			for(int s = 0; s < NUM_STATES; s++) {
+				for(int e = 0; e < NUM_EVENTS; e++) {
+					t.next[s][e] = NONE;
+					t.action[s][e] = nullptr;
+				}
+			}
+			for(size_t i = 0; i < N; i++) {
+				t.next[list[i].from][list[i].event] = (uint8_t)list[i].to;
+				t.action[list[i].from][list[i].event] = list[i].action;
+			}
+			return t;
+		}
+
+		StateMachine(Context& context, const Table& table, int initial)
+			: context(context), table(table), current(initial) {
+			static_assert(NUM_STATES < NONE && NUM_EVENTS <= 256, "too many states or events");
+		}
+
+		// Apply an event now, only on the owner task. Returns false if the event is ignored.
+		bool dispatch(int event) {
+			if(event < 0 || event >= NUM_EVENTS)
+				return false;
+			int from = current.load(std::memory_order_relaxed);
+			uint8_t to = table.next[from][event];
+			if(to == NONE)
+				return false;
+
+			Action action = table.action[from][event];
+			if(action != nullptr)
+				action(context);
+			current.store(to, std::memory_order_release);
+
+			TraceEntry& t = trace_buf[trace_cnt % TRACE_LEN];
+			t.time = pros::millis();
+			t.from = from;
+			t.event = event;
+			t.to = to;
+			trace_cnt++;
+			return true;
+		}
+
+		// Queue an event from any task, dropped if the queue is full
+		bool post(int event) {
+			return events.post((uint8_t)event);
+		}
+
+		// Dispatch the queued events, waits up to timeout msec for the first one
+		int process(uint32_t timeout = 0) {
+			int n = 0;
+			uint8_t event;
+			if(timeout > 0 && !events.wait(event, timeout))
+				return 0;
+			else if(timeout > 0 && dispatch(event))
+				n++;
+			while(events.poll(event)) {
+				if(dispatch(event))
+					n++;
+			}
+			return n;
+		}
+
+		// Post press_event and release_event from a controller button
+		void bind_button(Controller& controller, int button, int press_event, int release_event = -1) {
+			controller.button_pressed(button, [this, press_event]() {
+				post(press_event);
+			});
+			if(release_event >= 0) {
+				controller.button_released(button, [this, release_event]() {
+					post(release_event);
+				});
+			}
+		}
+
+		int state() const {
+			return current.load(std::memory_order_acquire);
+		}
+
+		// Recent transitions, 0 is the newest. Returns false past the recorded ones.
+		bool get_trace(int i, TraceEntry& entry) const {
+			if(i < 0 || i >= TRACE_LEN || i >= (int)trace_cnt)
+				return false;
+			entry = trace_buf[(trace_cnt - 1 - i) % TRACE_LEN];
+			return true;
+		}
+
+	private:
+		Context& context;
+		const Table table;		// copied once, so a temporary from build() is fine
+		std::atomic<int> current;
+		EventQueue<uint8_t, 16> events;
+		TraceEntry trace_buf[TRACE_LEN];
+		uint32_t trace_cnt = 0;
+	};
 }
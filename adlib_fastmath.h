@@ -0,0 +1,99 @@
+/********************************************************/
+/*  adlib_fastmath.h                                    */
+/*  Team 20850W, Accelerated Dragon                     */
+/*  Copyright (C) 2025                                  */
+/********************************************************/
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/********************************************************/
+/* Fast math for control and odometry loops             */
+/********************************************************/
+namespace adlib {
+	constexpr float FAST_PI = 3.14159265358979f;
+	constexpr int SIN_TABLE_BITS = 9;
+	constexpr int SIN_TABLE_SIZE = 1 << SIN_TABLE_BITS;	// entries per full turn
+
+	struct SinTable {
+		float f[SIN_TABLE_SIZE + 1];		// one extra entry so interpolation never wraps
+		int32_t q16[SIN_TABLE_SIZE + 1];
+	};
+
+	// Built at compile time with a Taylor series, exact to double precision
+	constexpr SinTable make_sin_table() {
+		SinTable t = {};
+		for(int i = 0; i <= SIN_TABLE_SIZE; i++) {
+			double x = 2 * 3.14159265358979323846 * i / SIN_TABLE_SIZE;
+			if(x > 3.14159265358979323846)
+				x -= 2 * 3.14159265358979323846;
+			double term = x, sum = x;
+			for(int n = 1; n < 20; n++) {
+				term *= -x * x / ((2 * n) * (2 * n + 1));
+				sum += term;
+			}
+			t.f[i] = (float)sum;
+			t.q16[i] = (int32_t)(sum * 65536 + (sum >= 0 ? 0.5 : -0.5));
+		}
+		return t;
+	}
+
+	inline constexpr SinTable sin_table = make_sin_table();
+
+	// Table sine with linear interpolation, |error| < 2e-5 for |rad| < 20
+	inline float fast_sin(float rad) {
+		float pos = rad * (SIN_TABLE_SIZE / (2 * FAST_PI));
+		float fl = floorf(pos);
+		int i = (int)fl & (SIN_TABLE_SIZE - 1);
+		float frac = pos - fl;
+		return sin_table.f[i] + (sin_table.f[i + 1] - sin_table.f[i]) * frac;
+	}
+
+	inline float fast_cos(float rad) {
+		return fast_sin(rad + FAST_PI / 2);
+	}
+
+	// Polynomial atan2 (Abramowitz and Stegun 4.4.49), |error| < 2e-5 rad in float
+	inline float fast_atan2(float y, float x) {
+		float ax = fabsf(x), ay = fabsf(y);
+		if(ax == 0 && ay == 0)
+			return 0;
+		bool swap = ay > ax;
+		float z = swap ? ax / ay : ay / ax;		// 0 <= z <= 1
+		float z2 = z * z;
+		float a = z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f + z2 * (-0.0851330f + z2 * 0.0208351f))));
+		if(swap)
+			a = FAST_PI / 2 - a;
+		if(x < 0)
+			a = FAST_PI - a;
+		return y < 0 ? -a : a;
+	}
+
+	// Single precision sqrt is one VFP instruction, the double version is not
+	inline float fast_sqrt(float x) {
+		return sqrtf(x);
+	}
+
+	// Q16.16 fixed point, angles are in Q16 turns (65536 = 360 degrees)
+	typedef int32_t q16_t;
+	constexpr q16_t Q16_ONE = 1 << 16;
+
+	inline q16_t q16_from_float(float v) { return (q16_t)(v * Q16_ONE); }
+	inline float q16_to_float(q16_t v) { return (float)v / Q16_ONE; }
+	inline q16_t q16_mul(q16_t a, q16_t b) { return (q16_t)(((int64_t)a * b) >> 16); }
+	inline q16_t q16_div(q16_t a, q16_t b) { return (q16_t)(((int64_t)a << 16) / b); }
+
+	// Table sine of a Q16 turn angle, |error| < 4e-5 (3 LSB)
+	inline q16_t q16_sin(q16_t turns) {
+		constexpr int FRAC_BITS = 16 - SIN_TABLE_BITS;
+		uint32_t a = (uint32_t)turns & 0xffff;
+		int i = a >> FRAC_BITS;
+		int32_t frac = a & ((1 << FRAC_BITS) - 1);
+		return sin_table.q16[i] + (((sin_table.q16[i + 1] - sin_table.q16[i]) * frac) >> FRAC_BITS);
+	}
+
+	inline q16_t q16_cos(q16_t turns) {
+		return q16_sin(turns + Q16_ONE / 4);
+	}
+}
@@ -0,0 +1,173 @@
+/********************************************************/
+/*  adlib_lockfree.h                                    */
+/*  Team 20850W, Accelerated Dragon                     */
+/*  Copyright (C) 2025                                  */
+/********************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Called while a reader waits for a writer that was preempted. adlib.h sets it to
+// pros::delay(1) so the writer task can run; the host tests use a thread yield.
+#ifndef ADLIB_YIELD
+#include <thread>
+#define ADLIB_YIELD() std::this_thread::yield()
+#endif
+
+/********************************************************/
+/* Lock-free primitives shared between tasks            */
+/********************************************************/
+namespace adlib {
+	// Ring buffer for one producer task and one consumer task, N must be a power of 2
+	template <typename T, size_t N>
+	class SpscRing {
+	public:
+		bool push(const T& item) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if(t - head.load(std::memory_order_acquire) == N)
+				return false;	// full
+			items[t & (N - 1)] = item;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(T& item) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if(h == tail.load(std::memory_order_acquire))
+				return false;	// empty
+			item = items[h & (N - 1)];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool empty() const {
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+
+		size_t size() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		}
+
+	private:
+		static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+		T items[N];
+		std::atomic<size_t> head{0};	// next slot to read
+		std::atomic<size_t> tail{0};	// next slot to write
+	};
+
+	// Ring buffer for many producer tasks and one consumer task, N must be a power of 2.
+	// Every slot carries a sequence number so producers claim slots with a single CAS.
+	template <typename T, size_t N>
+	class MpscRing {
+	public:
+		MpscRing() {
+			for(size_t i=0; i<N; i++) {
+				cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		// Claim a slot and let fill() write the item in place, returns false if full
+		template <typename F>
+		bool emplace(F fill) {
+			size_t pos = tail.load(std::memory_order_relaxed);
+			Cell* c;
+			while(true) {
+				c = &cells[pos & (N - 1)];
+				size_t seq = c->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if(diff == 0) {
+					if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if(diff < 0) {
+					return false;	// full
+				}
+				else {
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+			fill(c->item);
+			c->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool push(const T& item) {
+			return emplace([&](T& slot) { slot = item; });
+		}
+
+		// Only the consumer task may call pop()
+		bool pop(T& item) {
+			Cell& c = cells[head & (N - 1)];
+			if(c.seq.load(std::memory_order_acquire) != head + 1)
+				return false;	// empty, or the producer has not finished writing
+			item = c.item;
+			c.seq.store(head + N, std::memory_order_release);
+			head++;
+			return true;
+		}
+
+		bool empty() const {
+			return cells[head & (N - 1)].seq.load(std::memory_order_acquire) != head + 1;
+		}
+
+	private:
+		static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+		struct Cell {
+			std::atomic<size_t> seq;
+			T item;
+		};
+		Cell cells[N];
+		std::atomic<size_t> tail{0};	// next slot to claim, shared by producers
+		size_t head = 0;				// next slot to read, owned by the consumer
+	};
+
+	// Publish a snapshot from one writer task to any number of readers
+	template <typename T>
+	class SeqLock {
+	public:
+		void store(const T& value) {
+			size_t s = seq.load(std::memory_order_relaxed);
+			seq.store(s + 1, std::memory_order_relaxed);	// odd while writing
+			std::atomic_thread_fence(std::memory_order_release);
+			data = value;
+			seq.store(s + 2, std::memory_order_release);
+		}
+
+		T load() const {
+			T value;
+			size_t s0, s1;
+			while(true) {
+				s0 = seq.load(std::memory_order_acquire);
+				value = data;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				s1 = seq.load(std::memory_order_relaxed);
+				if(s0 == s1 && (s0 & 1) == 0)
+					return value;
+				// The writer was preempted in the middle of a store, let it finish
+				ADLIB_YIELD();
+			}
+		}
+
+		// Incremented by two on every store
+		size_t version() const {
+			return seq.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::atomic<size_t> seq{0};
+		T data{};
+	};
+
+	class AtomicFlag {
+	public:
+		void set() { flag.store(true, std::memory_order_release); }
+		void clear() { flag.store(false, std::memory_order_release); }
+		bool test() const { return flag.load(std::memory_order_acquire); }
+		bool test_and_clear() { return flag.exchange(false, std::memory_order_acq_rel); }
+		bool test_and_set() { return flag.exchange(true, std::memory_order_acq_rel); }
+	private:
+		std::atomic<bool> flag{false};
+	};
+}
@@ -0,0 +1,109 @@
+/********************************************************/
+/*  test_fastmath.cpp                                   */
+/*  Error sweep against libm and host timing of the     */
+/*  functions in adlib_fastmath.h, "make -C test"       */
+/********************************************************/
+#include "../adlib_fastmath.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace adlib;
+using Clock = std::chrono::steady_clock;
+
+static int failures = 0;
+
+static void check_bound(const char* name, double err, double bound) {
+	bool ok = err < bound;
+	printf("%-10s max error %.3g (bound %.0e) %s\n", name, err, bound, ok ? "ok" : "FAIL");
+	if(!ok)
+		failures++;
+}
+
+// sin and cos over the range the header promises, against double libm
+static void sweep_sin() {
+	double err_sin = 0, err_cos = 0;
+	const int n = 4000000;
+	for(int i = 0; i <= n; i++) {
+		float x = -20.0f + 40.0f * i / n;
+		err_sin = std::max(err_sin, fabs(fast_sin(x) - sin((double)x)));
+		err_cos = std::max(err_cos, fabs(fast_cos(x) - cos((double)x)));
+	}
+	check_bound("fast_sin", err_sin, 2e-5);
+	check_bound("fast_cos", err_cos, 2e-5);
+}
+
+// Every direction at several radii, plus the axes and the origin
+static void sweep_atan2() {
+	double err = 0;
+	const int n = 1000000;
+	const float radii[] = {1e-3f, 1.0f, 37.5f, 1e4f};
+	for(float r : radii) {
+		for(int i = 0; i < n; i++) {
+			double a = -M_PI + 2 * M_PI * i / n;
+			float x = (float)(r * cos(a)), y = (float)(r * sin(a));
+			double d = fabs(fast_atan2(y, x) - atan2((double)y, (double)x));
+			if(d > M_PI)
+				d = 2 * M_PI - d;	// +pi and -pi are the same direction
+			err = std::max(err, d);
+		}
+	}
+	check_bound("fast_atan2", err, 2e-5);
+	if(fast_atan2(0, 0) != 0 || fast_atan2(0, 1) != 0 || fabs(fast_atan2(1, 0) - M_PI / 2) > 1e-6) {
+		printf("fast_atan2 special cases FAIL\n");
+		failures++;
+	}
+}
+
+// All 65536 Q16 angles of one turn
+static void sweep_q16() {
+	double err_sin = 0, err_cos = 0;
+	for(int a = 0; a < Q16_ONE; a++) {
+		double rad = 2 * M_PI * a / Q16_ONE;
+		err_sin = std::max(err_sin, fabs(q16_to_float(q16_sin(a)) - sin(rad)));
+		err_cos = std::max(err_cos, fabs(q16_to_float(q16_cos(a)) - cos(rad)));
+	}
+	check_bound("q16_sin", err_sin, 4e-5);
+	check_bound("q16_cos", err_cos, 4e-5);
+
+	double err_mul = 0;
+	for(int i = -200; i <= 200; i++) {
+		for(int j = -200; j <= 200; j++) {
+			float a = i * 0.173f, b = j * 0.091f;
+			err_mul = std::max(err_mul, fabs(q16_to_float(q16_mul(q16_from_float(a), q16_from_float(b))) - (double)a * b));
+		}
+	}
+	check_bound("q16_mul", err_mul, 1e-3);
+	if(q16_div(q16_from_float(3.0f), q16_from_float(-1.5f)) != q16_from_float(-2.0f)) {
+		printf("q16_div FAIL\n");
+		failures++;
+	}
+}
+
+// Host ns per call, only the ratio to libm says anything about the robot
+template <typename F>
+static void bench(const char* name, F fn) {
+	const int n = 10000000;
+	volatile float sink = 0;
+	Clock::time_point t0 = Clock::now();
+	for(int i = 0; i < n; i++)
+		sink = sink + fn(i);
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / n;
+	printf("%-12s %6.2f ns/call\n", name, ns);
+}
+
+int main() {
+	sweep_sin();
+	sweep_atan2();
+	sweep_q16();
+
+	bench("fast_sin", [](int i) { return fast_sin(i * 1e-5f); });
+	bench("sinf", [](int i) { return sinf(i * 1e-5f); });
+	bench("fast_atan2", [](int i) { return fast_atan2((float)(i & 1023) - 512, (float)(i >> 10 & 1023) - 511); });
+	bench("atan2f", [](int i) { return atan2f((float)(i & 1023) - 512, (float)(i >> 10 & 1023) - 511); });
+	bench("q16_sin", [](int i) { return (float)q16_sin(i * 7); });
+
+	printf(failures == 0 ? "fastmath: all passed\n" : "fastmath: %d failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
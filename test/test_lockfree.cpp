@@ -0,0 +1,203 @@
+/********************************************************/
+/*  test_lockfree.cpp                                   */
+/*  Host stress test and throughput of the primitives   */
+/*  in adlib_lockfree.h, run with "make -C test"        */
+/********************************************************/
+#include "../adlib_lockfree.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace adlib;
+using Clock = std::chrono::steady_clock;
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; return; } } while(0)
+
+static double seconds_since(Clock::time_point t0) {
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// One producer sends 0, 1, 2, ... and the consumer must see them in order with none lost
+static void test_spsc(uint64_t count) {
+	static SpscRing<uint64_t, 1024> ring;
+	Clock::time_point t0 = Clock::now();
+	std::thread producer([&]() {
+		for(uint64_t i = 0; i < count; i++) {
+			while(!ring.push(i))
+				std::this_thread::yield();
+		}
+	});
+
+	uint64_t expect = 0;
+	bool ok = true;
+	while(expect < count) {
+		uint64_t v;
+		if(!ring.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		if(v != expect)
+			ok = false;
+		expect++;
+	}
+	producer.join();
+	double s = seconds_since(t0);
+	CHECK(ok, "spsc out of order");
+	CHECK(ring.empty() && ring.size() == 0, "spsc not empty at the end");
+	printf("spsc   %10llu items  %6.1f M items/s\n", (unsigned long long)count, count / s / 1e6);
+}
+
+// Every producer sends its id and a counter, each producer's items must arrive in order
+static void test_mpsc(int producers, uint64_t per_producer) {
+	static MpscRing<uint64_t, 256> ring;
+	Clock::time_point t0 = Clock::now();
+	std::vector<std::thread> threads;
+	for(int p = 0; p < producers; p++) {
+		threads.emplace_back([=]() {
+			for(uint64_t i = 0; i < per_producer; i++) {
+				while(!ring.push(((uint64_t)p << 40) | i))
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	std::vector<uint64_t> next(producers, 0);
+	uint64_t total = producers * per_producer;
+	bool ok = true;
+	for(uint64_t n = 0; n < total; ) {
+		uint64_t v;
+		if(!ring.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		int p = (int)(v >> 40);
+		uint64_t i = v & ((1ull << 40) - 1);
+		if(p >= producers || i != next[p])
+			ok = false;
+		else
+			next[p]++;
+		n++;
+	}
+	for(auto& t : threads)
+		t.join();
+	double s = seconds_since(t0);
+	CHECK(ok, "mpsc lost, duplicated or reordered an item");
+	CHECK(ring.empty(), "mpsc not empty at the end");
+	printf("mpsc x%d %10llu items  %6.1f M items/s\n", producers, (unsigned long long)total, total / s / 1e6);
+}
+
+// emplace() writes in place, a full ring must reject without calling fill
+static void test_mpsc_full() {
+	MpscRing<int, 4> ring;
+	for(int i = 0; i < 4; i++)
+		CHECK(ring.push(i), "push %d into an empty ring", i);
+	bool called = false;
+	CHECK(!ring.emplace([&](int& slot) { called = true; }), "push into a full ring");
+	CHECK(!called, "fill called on a full ring");
+	int v;
+	CHECK(ring.pop(v) && v == 0, "pop after full");
+}
+
+// The writer keeps every field equal, a reader must never see a torn snapshot
+struct Snapshot {
+	uint64_t a, b, c, d;
+};
+
+static void test_seqlock(int readers, uint64_t stores) {
+	static SeqLock<Snapshot> lock;
+	std::atomic<bool> done{false};
+	std::atomic<uint64_t> torn{0}, reads{0}, backwards{0};
+	std::vector<std::thread> threads;
+	for(int r = 0; r < readers; r++) {
+		threads.emplace_back([&]() {
+			uint64_t last = 0;
+			while(!done.load()) {
+				Snapshot s = lock.load();
+				if(s.a != s.b || s.b != s.c || s.c != s.d)
+					torn++;
+				if(s.a < last)
+					backwards++;
+				last = s.a;
+				reads++;
+			}
+		});
+	}
+
+	Clock::time_point t0 = Clock::now();
+	for(uint64_t i = 1; i <= stores; i++) {
+		lock.store({i, i, i, i});
+		if((i & 255) == 0)
+			std::this_thread::yield();
+	}
+	double s = seconds_since(t0);
+	done.store(true);
+	for(auto& t : threads)
+		t.join();
+	CHECK(torn.load() == 0, "seqlock %llu torn reads", (unsigned long long)torn.load());
+	CHECK(backwards.load() == 0, "seqlock went back in time %llu times", (unsigned long long)backwards.load());
+	CHECK(lock.version() == 2 * stores, "seqlock version %zu", lock.version());
+	printf("seqlock x%d %8llu stores %6.1f M stores/s, %llu reads\n", readers, (unsigned long long)stores,
+		   stores / s / 1e6, (unsigned long long)reads.load());
+}
+
+// A flag set after writing data must publish the data to the task that sees it
+static void test_flag(int rounds) {
+	AtomicFlag ready, ack;
+	uint64_t data = 0;
+	bool ok = true;
+	std::thread consumer([&]() {
+		for(int i = 1; i <= rounds; i++) {
+			while(!ready.test_and_clear())
+				std::this_thread::yield();
+			if(data != (uint64_t)i)
+				ok = false;
+			ack.set();
+		}
+	});
+	for(int i = 1; i <= rounds; i++) {
+		data = i;
+		ready.set();
+		while(!ack.test_and_clear())
+			std::this_thread::yield();
+	}
+	consumer.join();
+	CHECK(ok, "flag did not publish the data");
+	CHECK(!ready.test(), "flag left set");
+}
+
+// Of several tasks racing test_and_set(), exactly one must see the flag clear
+static void test_flag_claim(int threads, int rounds) {
+	int bad = 0;
+	for(int r = 0; r < rounds; r++) {
+		AtomicFlag claim;
+		std::atomic<int> winners{0};
+		std::vector<std::thread> t;
+		for(int i = 0; i < threads; i++) {
+			t.emplace_back([&]() {
+				if(!claim.test_and_set())
+					winners++;
+			});
+		}
+		for(auto& th : t)
+			th.join();
+		if(winners.load() != 1)
+			bad++;
+	}
+	CHECK(bad == 0, "test_and_set had %d rounds without exactly one winner", bad);
+}
+
+int main() {
+	test_spsc(4000000);
+	test_mpsc(1, 1000000);
+	test_mpsc(4, 500000);
+	test_mpsc_full();
+	test_seqlock(3, 500000);
+	test_flag(100000);
+	test_flag_claim(4, 2000);
+	printf(failures == 0 ? "lockfree: all passed\n" : "lockfree: %d failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}